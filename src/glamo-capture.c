@@ -0,0 +1,134 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Capture of every command buffer the driver submits, for offline analysis
+ * with tools/glamo-trace.  Enabled with Option "CaptureFile" or the
+ * GLAMO_CAPTURE environment variable, which names the trace file.  The
+ * variable is ignored when the server runs setuid, as the server does with
+ * -logfile, since anyone could use it to overwrite files.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include "glamo.h"
+#include "glamo-capture.h"
+
+Bool
+GlamoCaptureOpen(ScrnInfoPtr pScrn, const char *filename,
+                 enum glamo_capture_source source)
+{
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+    struct glamo_capture_header header;
+    int fd;
+
+    pGlamo->capture_fd = -1;
+
+    if (!filename) {
+        filename = getenv("GLAMO_CAPTURE");
+        if (filename && *filename && GlamoPrivsElevated()) {
+            xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                       "Ignoring GLAMO_CAPTURE in a privileged server, "
+                       "use Option \"CaptureFile\"\n");
+            return FALSE;
+        }
+    }
+    if (!filename || !*filename)
+        return FALSE;
+
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                   "Couldn't open \"%s\" for command capture: %s\n",
+                   filename, strerror(errno));
+        return FALSE;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = GLAMO_CAPTURE_MAGIC;
+    header.version = GLAMO_CAPTURE_VERSION;
+    header.source = source;
+    if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                   "Couldn't write to \"%s\": %s\n",
+                   filename, strerror(errno));
+        close(fd);
+        return FALSE;
+    }
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Capturing command stream to \"%s\"\n", filename);
+    pGlamo->capture_fd = fd;
+
+    return TRUE;
+}
+
+void
+GlamoCaptureWrite(GlamoPtr pGlamo, const void *cmds, size_t cmd_bytes,
+                  const uint32_t *handles, const uint32_t *offsets,
+                  int nrelocs)
+{
+    struct glamo_capture_record record;
+    struct timeval tv;
+    struct iovec iov[4];
+    ssize_t len;
+
+    gettimeofday(&tv, NULL);
+    record.tv_sec = tv.tv_sec;
+    record.tv_usec = tv.tv_usec;
+    record.cmd_bytes = cmd_bytes;
+    record.nrelocs = nrelocs;
+
+    iov[0].iov_base = &record;
+    iov[0].iov_len = sizeof(record);
+    iov[1].iov_base = (void *)cmds;
+    iov[1].iov_len = cmd_bytes;
+    iov[2].iov_base = (void *)handles;
+    iov[2].iov_len = nrelocs * sizeof(uint32_t);
+    iov[3].iov_base = (void *)offsets;
+    iov[3].iov_len = nrelocs * sizeof(uint32_t);
+
+    len = writev(pGlamo->capture_fd, iov, nrelocs ? 4 : 2);
+    if (len != (ssize_t)(sizeof(record) + cmd_bytes
+                         + 2 * nrelocs * sizeof(uint32_t))) {
+        xf86DrvMsg(xf86Screens[pGlamo->pScreen->myNum]->scrnIndex, X_ERROR,
+                   "Command capture failed, stopping: %s\n",
+                   len < 0 ? strerror(errno) : "short write");
+        GlamoCaptureClose(pGlamo);
+    }
+}
+
+void
+GlamoCaptureClose(GlamoPtr pGlamo)
+{
+    if (pGlamo->capture_fd == -1)
+        return;
+
+    close(pGlamo->capture_fd);
+    pGlamo->capture_fd = -1;
+}
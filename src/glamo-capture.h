@@ -0,0 +1,81 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef _GLAMO_CAPTURE_H_
+#define _GLAMO_CAPTURE_H_
+
+#include <stdint.h>
+
+/*
+ * Command stream trace files, in host byte order:
+ *
+ *   struct glamo_capture_header
+ *   for each submitted command buffer:
+ *     struct glamo_capture_record
+ *     uint16_t cmds[cmd_bytes / 2]      (register, value) pairs and bursts
+ *     uint32_t handles[nrelocs]         GEM handles (DRM only)
+ *     uint32_t offsets[nrelocs]         byte offsets of the relocations
+ *
+ * The file is read by tools/glamo-trace, which only includes this part.
+ */
+
+#define GLAMO_CAPTURE_MAGIC	0x544d4c47	/* "GLMT" */
+#define GLAMO_CAPTURE_VERSION	1
+
+enum glamo_capture_source {
+	GLAMO_CAPTURE_SOURCE_RING = 0,	/* GLAMODispatchCMDQ */
+	GLAMO_CAPTURE_SOURCE_DRM = 1,	/* GlamoDRMDispatch */
+};
+
+struct glamo_capture_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t source;
+	uint32_t reserved;
+};
+
+struct glamo_capture_record {
+	uint32_t tv_sec;
+	uint32_t tv_usec;
+	uint32_t cmd_bytes;
+	uint32_t nrelocs;
+};
+
+#ifndef GLAMO_CAPTURE_FORMAT_ONLY
+
+#include "glamo.h"
+
+Bool
+GlamoCaptureOpen(ScrnInfoPtr pScrn, const char *filename,
+                 enum glamo_capture_source source);
+
+void
+GlamoCaptureWrite(GlamoPtr pGlamo, const void *cmds, size_t cmd_bytes,
+                  const uint32_t *handles, const uint32_t *offsets,
+                  int nrelocs);
+
+void
+GlamoCaptureClose(GlamoPtr pGlamo);
+
+#endif /* GLAMO_CAPTURE_FORMAT_ONLY */
+
+#endif /* _GLAMO_CAPTURE_H_ */
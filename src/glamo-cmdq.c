@@ -29,12 +29,18 @@
 #include "glamo-regs.h"
 #include "glamo-cmdq.h"
 #include "glamo-engine.h"
+#include "glamo-sim.h"
+#include "glamo-capture.h"
+#include "glamo-peephole.h"
+#include "glamo-timing.h"
 
 static void
 GLAMOCMDQResetCP(GlamoPtr pGlamo);
 
-#define CQ_LEN 255
-#define CQ_MASK ((CQ_LEN + 1) * 1024 - 1)
+/* The ring is a power of two between 4 KiB and 1 MiB, so offsets into it
+ * wrap with a mask.  CMDQ_LEN holds its size in KiB, minus one. */
+#define CQ_LEN (pGlamo->ring_len / 1024 - 1)
+#define CQ_MASK (pGlamo->ring_len - 1)
 #define CQ_MASKL (CQ_MASK & 0xffff)
 #define CQ_MASKH (CQ_MASK >> 16)
 
@@ -73,10 +79,29 @@ GLAMODispatchCMDQ(GlamoPtr pGlamo)
     size_t ring_read;
     size_t new_ring_write;
     size_t ring_write;
+    int polls = 0;
+    GLAMO_TIMING_LOCAL(start);
+    GLAMO_TIMING_LOCAL(wait_start);
 
     if (!buf->used)
         return;
 
+    GLAMO_TIMING_BEGIN(start);
+
+    if (pGlamo->peephole) {
+        int nrelocs = 0;
+
+        buf->used = 2 * GlamoPeepholeRun(pGlamo, (uint16_t *)buf->data,
+                                         buf->used / 2, NULL, NULL,
+                                         &nrelocs, NULL);
+    }
+
+    pGlamo->stats.submissions++;
+    pGlamo->stats.bytes_submitted += buf->used;
+
+    if (pGlamo->capture_fd != -1)
+        GlamoCaptureWrite(pGlamo, buf->data, buf->used, NULL, NULL, 0);
+
     addr = buf->data;
 	count = buf->used;
 	ring_count = pGlamo->ring_len;
@@ -86,17 +111,28 @@ GLAMODispatchCMDQ(GlamoPtr pGlamo)
     new_ring_write = (((ring_write + count) & CQ_MASK) + 1) & ~1;
 
     /* Wait until there is enough space to queue the cmd buffer */
+    GLAMO_TIMING_BEGIN(wait_start);
     if (new_ring_write > ring_write) {
         do {
-	        ring_read = MMIO_IN16(mmio, GLAMO_REG_CMDQ_READ_ADDRL) & CQ_MASKL;
-        	ring_read |= ((MMIO_IN16(mmio, GLAMO_REG_CMDQ_READ_ADDRH) & CQ_MASKH) << 16);
+            if (pGlamo->sim)
+                GLAMOSimPoll(pGlamo);
+            ring_read = MMIO_IN16(mmio, GLAMO_REG_CMDQ_READ_ADDRL) & CQ_MASKL;
+            ring_read |= ((MMIO_IN16(mmio, GLAMO_REG_CMDQ_READ_ADDRH) & CQ_MASKH) << 16);
+            polls++;
         } while(ring_read > ring_write && ring_read < new_ring_write);
     } else {
         do {
-	        ring_read = MMIO_IN16(mmio, GLAMO_REG_CMDQ_READ_ADDRL) & CQ_MASKL;
-        	ring_read |= ((MMIO_IN16(mmio, GLAMO_REG_CMDQ_READ_ADDRH) & CQ_MASKH) << 16);
+            if (pGlamo->sim)
+                GLAMOSimPoll(pGlamo);
+            ring_read = MMIO_IN16(mmio, GLAMO_REG_CMDQ_READ_ADDRL) & CQ_MASKL;
+            ring_read |= ((MMIO_IN16(mmio, GLAMO_REG_CMDQ_READ_ADDRH) & CQ_MASKH) << 16);
+            polls++;
         } while(ring_read > ring_write || ring_read < new_ring_write);
     }
+    if (polls > 1) {
+        pGlamo->stats.ring_full_waits++;
+        GLAMO_TIMING_END(wait_start, GLAMO_PHASE_RING_WAIT);
+    }
 
     /* Wrap around */
     if (ring_write >= new_ring_write) {
@@ -132,10 +168,71 @@ GLAMODispatchCMDQ(GlamoPtr pGlamo)
 	MMIO_OUT16(mmio, GLAMO_REG_CMDQ_WRITE_ADDRL,
 			   new_ring_write & CQ_MASKL);
 
+    if (pGlamo->sim)
+        GLAMOSimRun(pGlamo);
+
     MMIOSetBitMask(mmio, GLAMO_REG_CLOCK_2D,
                 GLAMO_CLOCK_2D_EN_M6CLK,
 					0xffff);
     buf->used = 0;
+    pGlamo->kick_next = pGlamo->batch_size / 8;
+
+    /* The engine was idle before this batch, so it is all that's busy.
+     * The rest of the current operation will use the same memory. */
+    pGlamo->busy_start = pGlamo->queued_start;
+    pGlamo->busy_end = pGlamo->queued_end;
+    pGlamo->queued_start = pGlamo->op_start;
+    pGlamo->queued_end = pGlamo->op_end;
+
+    GLAMO_TIMING_END(start, GLAMO_PHASE_DISPATCH);
+}
+
+/* End a batch of operations.  GLAMODispatchCMDQ() waits for the engine,
+ * so dispatching while it is still busy would only stall the CPU: the
+ * commands are held back and more queued behind them, until the engine has
+ * gone idle or batch_size bytes are waiting.  Everything that touches the
+ * memory they use, and the block handler, dispatches them first. */
+void
+GLAMOFlushCMDQ(GlamoPtr pGlamo)
+{
+    MemBuf *buf = pGlamo->cmd_queue;
+
+    if (!buf->used)
+        return;
+
+    if (!GLAMOEngineBusy(pGlamo, GLAMO_ENGINE_ALL)) {
+        pGlamo->stats.flushes_idle++;
+    } else if (buf->used >= pGlamo->batch_size) {
+        pGlamo->stats.flushes_full++;
+    } else {
+        pGlamo->stats.flushes_deferred++;
+        return;
+    }
+
+    GLAMODispatchCMDQ(pGlamo);
+}
+
+/* Called as an operation queues commands.  Every eighth of the batch size,
+ * see whether the engine has run out of work, and if so hand it what has
+ * been queued so far rather than leave it idle until the operation ends. */
+void
+GLAMOKickCMDQ(GlamoPtr pGlamo)
+{
+    MemBuf *buf = pGlamo->cmd_queue;
+
+    if (!pGlamo->batch_size || buf->used < pGlamo->kick_next)
+        return;
+    pGlamo->kick_next = buf->used + pGlamo->batch_size / 8;
+
+    if (!GLAMOEngineBusy(pGlamo, GLAMO_ENGINE_ALL)) {
+        pGlamo->stats.flushes_starved++;
+    } else if (buf->used >= pGlamo->batch_size) {
+        pGlamo->stats.flushes_full++;
+    } else {
+        return;
+    }
+
+    GLAMODispatchCMDQ(pGlamo);
 }
 
 static void
@@ -165,16 +262,28 @@ GLAMOCMDQResetCP(GlamoPtr pGlamo)
 	GLAMOEngineWait(pGlamo, GLAMO_ENGINE_ALL);
 }
 
+/* Put the ring at the top of the given region, which leaves the space
+ * below it to grow or shrink with the screen */
 size_t
 GLAMOCMDQInit(ScrnInfoPtr pScrn, size_t mem_start, size_t mem_size)
 {
     GlamoPtr pGlamo = GlamoPTR(pScrn);
     MemBuf *buf;
 
-    pGlamo->ring_start = mem_start;
-    pGlamo->ring_addr = pGlamo->fbstart + pGlamo->ring_start;
+    if (!pGlamo->ring_len)
+        pGlamo->ring_len = GLAMO_CMDQ_DEFAULT_SIZE;
 
-    pGlamo->ring_len = (CQ_LEN + 1) * 1024;
+    if (pGlamo->ring_len > mem_size) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                   "No room for a %zu KiB command queue in %zu KiB of "
+                   "video memory\n", pGlamo->ring_len / 1024,
+                   mem_size / 1024);
+        return 0;
+    }
+
+    pGlamo->ring_start = (mem_start + mem_size - pGlamo->ring_len)
+                         & ~(size_t)1023;
+    pGlamo->ring_addr = pGlamo->fbstart + pGlamo->ring_start;
 
     buf = (MemBuf *)calloc(1, sizeof(MemBuf) + pGlamo->ring_len);
 
@@ -185,6 +294,10 @@ GLAMOCMDQInit(ScrnInfoPtr pScrn, size_t mem_start, size_t mem_size)
 	buf->size = pGlamo->ring_len;
 	buf->used = 0;
 
+    if (pGlamo->batch_size > pGlamo->ring_len)
+        pGlamo->batch_size = pGlamo->ring_len;
+    pGlamo->kick_next = pGlamo->batch_size / 8;
+
 	pGlamo->cmd_queue = buf;
 
     return pGlamo->ring_len;
@@ -218,6 +331,8 @@ GLAMOCMDQFini(ScrnInfoPtr pScrn) {
 	    free(pGlamo->cmd_queue);
 	    pGlamo->cmd_queue = NULL;
     }
+
+    GlamoPeepholeFini();
 }
 
 #if 0
@@ -28,6 +28,14 @@
 
 #define CCE_DEBUG 0
 
+/* Command queue sizes, in bytes; Option "RingSize" takes KiB */
+#define GLAMO_CMDQ_DEFAULT_SIZE	(256 * 1024)
+#define GLAMO_CMDQ_MIN_SIZE	(4 * 1024)
+#define GLAMO_CMDQ_MAX_SIZE	(1024 * 1024)
+
+/* Default for Option "BatchSize", in bytes */
+#define GLAMO_CMDQ_DEFAULT_BATCH	(16 * 1024)
+
 #if !CCE_DEBUG
 
 #define RING_LOCALS	CARD16 *__head; int __count
@@ -135,6 +143,12 @@ tv_le(struct timeval *tv1, struct timeval *tv2)
 void
 GLAMODispatchCMDQ(GlamoPtr pGlamo);
 
+void
+GLAMOFlushCMDQ(GlamoPtr pGlamo);
+
+void
+GLAMOKickCMDQ(GlamoPtr pGlamo);
+
 size_t
 GLAMOCMDQInit(ScrnInfoPtr pScrn, size_t mem_start, size_t mem_size);
 
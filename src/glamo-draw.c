@@ -26,12 +26,21 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#include <stdlib.h>
+
 #include "glamo-log.h"
 #include "glamo.h"
 #include "glamo-regs.h"
 #include "glamo-cmdq.h"
 #include "glamo-draw.h"
 #include "glamo-engine.h"
+#include "glamo-render.h"
+#include "glamo-timing.h"
+
+/* Rows per band when splitting operations on pixmaps taller than the
+ * coordinate registers reach.  Half of the limit, so that an overlapping
+ * copy can keep both its source and destination in one band's range. */
+#define GLAMO_2D_BAND (GLAMO_2D_MAX_COORD / 2)
 
 static const CARD8 GLAMOSolidRop[16] = {
     /* GXclear      */      0x00,         /* 0 */
@@ -156,9 +165,117 @@ GLAMOExaDownloadFromScreen(PixmapPtr pSrc,
 			   char *dst,
 			   int dst_pitch);
 
+Bool
+GLAMOExaUploadToScratch(PixmapPtr pSrc, PixmapPtr pDst);
+
 void
 GLAMOExaWaitMarker (ScreenPtr pScreen, int marker);
 
+/* Record that the commands being queued use some video memory */
+static void
+GLAMOQueueRange(GlamoPtr pGlamo, CARD32 start, CARD32 end)
+{
+	if (pGlamo->queued_start == pGlamo->queued_end) {
+		pGlamo->queued_start = start;
+		pGlamo->queued_end = end;
+	} else {
+		pGlamo->queued_start = min(pGlamo->queued_start, start);
+		pGlamo->queued_end = max(pGlamo->queued_end, end);
+	}
+}
+
+/* Record that the current operation uses a pixmap.  It stays queued until
+ * GLAMOEndOp(), even if a batch is dispatched before then. */
+static void
+GLAMOQueuePixmap(GlamoPtr pGlamo, PixmapPtr pPix)
+{
+	CARD32 start = exaGetPixmapOffset(pPix);
+	CARD32 end = start + exaGetPixmapPitch(pPix) * pPix->drawable.height;
+
+	GLAMOQueueRange(pGlamo, start, end);
+
+	if (pGlamo->op_start == pGlamo->op_end) {
+		pGlamo->op_start = start;
+		pGlamo->op_end = end;
+	} else {
+		pGlamo->op_start = min(pGlamo->op_start, start);
+		pGlamo->op_end = max(pGlamo->op_end, end);
+	}
+}
+
+static void
+GLAMOEndOp(GlamoPtr pGlamo)
+{
+	pGlamo->op_start = pGlamo->op_end = 0;
+
+	/* The operation may have been dispatched in full */
+	if (!pGlamo->cmd_queue->used)
+		pGlamo->queued_start = pGlamo->queued_end = 0;
+}
+
+/* Whether the engine may still use some video memory, now or in the
+ * commands still queued */
+static Bool
+GLAMORangeBusy(GlamoPtr pGlamo, CARD32 start, CARD32 end)
+{
+	if (start < pGlamo->queued_end && pGlamo->queued_start < end)
+		return TRUE;
+
+	if (start < pGlamo->busy_end && pGlamo->busy_start < end) {
+		if (GLAMOEngineBusy(pGlamo, GLAMO_ENGINE_ALL))
+			return TRUE;
+		pGlamo->busy_start = pGlamo->busy_end = 0;
+	}
+
+	return FALSE;
+}
+
+/* Make sure the engine is done with some video memory before the CPU
+ * touches it.  GLAMODispatchCMDQ() waits for the engine before starting a
+ * batch, so only the last one can still be running, and there is nothing
+ * to wait for unless it or the commands still queued use the memory. */
+static void
+GLAMOWaitRange(GlamoPtr pGlamo, CARD32 start, CARD32 end)
+{
+	if (start < pGlamo->queued_end && pGlamo->queued_start < end)
+		GLAMODispatchCMDQ(pGlamo);
+
+	if (start < pGlamo->busy_end && pGlamo->busy_start < end) {
+		GLAMOEngineWait(pGlamo, GLAMO_ENGINE_ALL);
+		pGlamo->busy_start = pGlamo->busy_end = 0;
+	}
+}
+
+static void
+GLAMOWaitPixmap(GlamoPtr pGlamo, PixmapPtr pPix)
+{
+	CARD32 start = exaGetPixmapOffset(pPix);
+
+	GLAMOWaitRange(pGlamo, start,
+		       start + exaGetPixmapPitch(pPix) * pPix->drawable.height);
+}
+
+/* Take the next size bytes of the staging area.  The area is used in
+ * order, and only needs to be waited for when going back to its start, by
+ * which time the blits from it have usually finished. */
+static CARD32
+GLAMOStagingAlloc(GlamoPtr pGlamo, size_t size)
+{
+	CARD32 offset;
+
+	if (pGlamo->staging_head + size > pGlamo->staging_size) {
+		GLAMODispatchCMDQ(pGlamo);
+		GLAMOEngineWait(pGlamo, GLAMO_ENGINE_ALL);
+		pGlamo->busy_start = pGlamo->busy_end = 0;
+		pGlamo->staging_head = 0;
+	}
+
+	offset = pGlamo->staging_start + pGlamo->staging_head;
+	pGlamo->staging_head += (size + 3) & ~3;
+
+	return offset;
+}
+
 static void
 GLAMOBlockHandler(pointer blockData, OSTimePtr timeout, pointer readmask)
 {
@@ -172,10 +289,14 @@ GLAMOWakeupHandler(pointer blockData, int result, pointer readmask)
 {
 }
 
+/* Share the video memory from mem_start to mem_start + mem_size between
+ * the command queue, at the top, the staging area for uploads below it,
+ * and EXA's offscreen pixmaps */
 size_t
 GLAMODrawInit(ScrnInfoPtr pScrn, size_t mem_start, size_t mem_size)
 {
-    size_t mem_used;
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+    size_t mem_used, exa_size;
 
     mem_used = GLAMOCMDQInit(pScrn, mem_start, mem_size);
 
@@ -184,18 +305,54 @@ GLAMODrawInit(ScrnInfoPtr pScrn, size_t mem_start, size_t mem_size)
         return FALSE;
     }
 
-    if (!GLAMODrawExaInit(pScrn, mem_start + mem_used, mem_size - mem_used))
+    /* Only take the staging area if it leaves at least as much again for
+     * pixmaps; uploads just wait for the engine without it */
+    exa_size = pGlamo->ring_start - mem_start;
+    pGlamo->staging_size = 0;
+    pGlamo->staging_head = 0;
+    if (exa_size >= 2 * GLAMO_STAGING_SIZE) {
+        pGlamo->staging_size = GLAMO_STAGING_SIZE;
+        exa_size -= GLAMO_STAGING_SIZE;
+    }
+    pGlamo->staging_start = mem_start + exa_size;
+
+    if (!GLAMODrawExaInit(pScrn, mem_start, exa_size))
         return 0;
 
     return mem_size;
 }
 
+/* Move the start of the offscreen memory to follow a change of the screen
+ * size.  RandR disables framebuffer access around the resize, which moves
+ * all offscreen pixmaps out of video memory, and EXA lays out its offscreen
+ * heap afresh from offScreenBase when access is enabled again. */
+Bool
+GLAMODrawResize(ScrnInfoPtr pScrn, size_t front_size)
+{
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+
+    if (!pGlamo->exa)
+        return TRUE;
+
+    if (front_size > pGlamo->staging_start) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                   "A %zu KiB screen would overlap the command queue\n",
+                   front_size / 1024);
+        return FALSE;
+    }
+
+    pGlamo->exa->offScreenBase = front_size;
+
+    return TRUE;
+}
+
 void
 GLAMODrawFini(ScrnInfoPtr pScrn) {
     GlamoPtr pGlamo = GlamoPTR(pScrn);
 
     GLAMOCMDQFini(pScrn);
     if (pGlamo->exa) {
+        GLAMORenderFini(pGlamo->pScreen);
         exaDriverFini(pGlamo->pScreen);
         free(pGlamo->exa);
         pGlamo->exa = NULL;
@@ -243,10 +400,14 @@ GLAMODrawExaInit(ScrnInfoPtr pScrn, size_t mem_start, size_t mem_size)
 
     pGlamo->exa->memoryBase = pGlamo->fbstart;
     pGlamo->exa->memorySize = mem_size + mem_start;
-    /* TODO: Initalize offScreenBase based on the current screen resolution
-     * (width*height*depth) */
+    /* Everything below mem_start is the visible screen; see
+     * GLAMODrawResize() for how this follows mode changes */
     pGlamo->exa->offScreenBase = mem_start;
 
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "%zu KiB of offscreen memory for pixmaps\n",
+		   mem_size / 1024);
+
 	exa->exa_major = EXA_VERSION_MAJOR;
 	exa->exa_minor = EXA_VERSION_MINOR;
 
@@ -265,6 +426,8 @@ GLAMODrawExaInit(ScrnInfoPtr pScrn, size_t mem_start, size_t mem_size)
 
 	exa->DownloadFromScreen = GLAMOExaDownloadFromScreen;
 	exa->UploadToScreen = GLAMOExaUploadToScreen;
+	if (pGlamo->staging_size)
+		exa->UploadToScratch = GLAMOExaUploadToScratch;
 
 	/*glamos->exa.MarkSync = GLAMOExaMarkSync;*/
 	exa->WaitMarker = GLAMOExaWaitMarker;
@@ -272,8 +435,11 @@ GLAMODrawExaInit(ScrnInfoPtr pScrn, size_t mem_start, size_t mem_size)
 	exa->pixmapOffsetAlign = 2;
 	exa->pixmapPitchAlign = 2;
 
-	exa->maxX = 640;
-	exa->maxY = 640;
+	/* The pitch limits the width.  Taller pixmaps than the coordinate
+	 * registers reach are handled in bands, up to the 8 MiB the address
+	 * registers can reach. */
+	exa->maxX = (GLAMO_2D_MAX_PITCH + 1) / 2 - 1;
+	exa->maxY = 4096;
 
 	exa->flags = EXA_OFFSCREEN_PIXMAPS;
 
@@ -284,6 +450,7 @@ GLAMODrawExaInit(ScrnInfoPtr pScrn, size_t mem_start, size_t mem_size)
 	success = exaDriverInit(pGlamo->pScreen, exa);
 	if (success) {
 		ErrorF("Initialized EXA acceleration\n");
+		GLAMORenderInit(pGlamo->pScreen);
 	} else {
 		ErrorF("Failed to initialize EXA acceleration\n");
         free(pGlamo->exa);
@@ -306,55 +473,114 @@ GLAMOExaPrepareSolid(PixmapPtr      pPix,
     CARD16 op, pitch;
 	FbBits mask;
 	RING_LOCALS;
+	GLAMO_TIMING_LOCAL(start);
 
+	GLAMO_TIMING_BEGIN(start);
 	if (pPix->drawable.bitsPerPixel != 16)
-		GLAMO_FALLBACK(("Only 16bpp is supported\n"));
+		GLAMO_FALLBACK(GLAMO_FALLBACK_BPP,
+			       ("Only 16bpp is supported\n"));
 
     mask = FbFullMask(16);
 	if ((pm & mask) != mask)
-		GLAMO_FALLBACK(("Can't do planemask 0x%08x\n",
+		GLAMO_FALLBACK(GLAMO_FALLBACK_PLANEMASK,
+			       ("Can't do planemask 0x%08x\n",
 				(unsigned int) pm));
 	op = GLAMOSolidRop[alu] << 8;
 	offset = exaGetPixmapOffset(pPix);
 	pitch = exaGetPixmapPitch(pPix);
+	if (pitch > GLAMO_2D_MAX_PITCH)
+		GLAMO_FALLBACK(GLAMO_FALLBACK_SIZE,
+			       ("Pitch %d is too wide\n", pitch));
+	GLAMOQueuePixmap(pGlamo, pPix);
 
 	BEGIN_CMDQ(16);
 	OUT_REG(GLAMO_REG_2D_DST_ADDRL, offset & 0xffff);
 	OUT_REG(GLAMO_REG_2D_DST_ADDRH, (offset >> 16) & 0x7f);
 	OUT_REG(GLAMO_REG_2D_DST_PITCH, pitch & 0x7ff);
-	OUT_REG(GLAMO_REG_2D_DST_HEIGHT, pPix->drawable.height);
+	OUT_REG(GLAMO_REG_2D_DST_HEIGHT,
+		min(pPix->drawable.height, GLAMO_2D_MAX_COORD));
 	OUT_REG(GLAMO_REG_2D_PAT_FG, fg);
 	OUT_REG(GLAMO_REG_2D_COMMAND2, op);
 	OUT_REG(GLAMO_REG_2D_ID1, 0);
 	OUT_REG(GLAMO_REG_2D_ID2, 0);
 	END_CMDQ();
 
+	GLAMO_TIMING_END(start, GLAMO_PHASE_PREPARE);
+	GLAMO_TIMING_EMIT_BEGIN();
 	return TRUE;
 }
 
-void
-GLAMOExaSolid(PixmapPtr pPix, int x1, int y1, int x2, int y2)
+/* Point the source or destination of the 2D engine at a row of a pixmap,
+ * for operations on pixmaps taller than GLAMO_2D_MAX_COORD */
+static void
+GLAMOSetSurface(GlamoPtr pGlamo, PixmapPtr pPix, int row, Bool dst)
 {
-	ScrnInfoPtr pScrn = xf86Screens[pPix->drawable.pScreen->myNum];
-	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	CARD32 offset;
+	RING_LOCALS;
+
+	offset = exaGetPixmapOffset(pPix) + row * exaGetPixmapPitch(pPix);
+
+	if (dst) {
+		BEGIN_CMDQ(6);
+		OUT_REG(GLAMO_REG_2D_DST_ADDRL, offset & 0xffff);
+		OUT_REG(GLAMO_REG_2D_DST_ADDRH, (offset >> 16) & 0x7f);
+		OUT_REG(GLAMO_REG_2D_DST_HEIGHT,
+			min(pPix->drawable.height - row, GLAMO_2D_MAX_COORD));
+		END_CMDQ();
+	} else {
+		BEGIN_CMDQ(4);
+		OUT_REG(GLAMO_REG_2D_SRC_ADDRL, offset & 0xffff);
+		OUT_REG(GLAMO_REG_2D_SRC_ADDRH, (offset >> 16) & 0x7f);
+		END_CMDQ();
+	}
+}
 
+static void
+GLAMOSolidRect(GlamoPtr pGlamo, int x, int y, int width, int height)
+{
 	RING_LOCALS;
 
 	BEGIN_CMDQ(10);
-	OUT_REG(GLAMO_REG_2D_DST_X, x1);
-	OUT_REG(GLAMO_REG_2D_DST_Y, y1);
-	OUT_REG(GLAMO_REG_2D_RECT_WIDTH, x2 - x1);
-	OUT_REG(GLAMO_REG_2D_RECT_HEIGHT, y2 - y1);
+	OUT_REG(GLAMO_REG_2D_DST_X, x);
+	OUT_REG(GLAMO_REG_2D_DST_Y, y);
+	OUT_REG(GLAMO_REG_2D_RECT_WIDTH, width);
+	OUT_REG(GLAMO_REG_2D_RECT_HEIGHT, height);
 	OUT_REG(GLAMO_REG_2D_COMMAND3, 0);
 	END_CMDQ();
 }
 
+void
+GLAMOExaSolid(PixmapPtr pPix, int x1, int y1, int x2, int y2)
+{
+	ScrnInfoPtr pScrn = xf86Screens[pPix->drawable.pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	int y, h;
+
+	GLAMO_STAT_OP(pGlamo, GLAMO_STAT_SOLID);
+
+	if (pPix->drawable.height <= GLAMO_2D_MAX_COORD) {
+		GLAMOSolidRect(pGlamo, x1, y1, x2 - x1, y2 - y1);
+	} else {
+		/* Fill in bands, each with the destination moved to its
+		 * first row */
+		for (y = y1; y < y2; y += h) {
+			h = min(y2 - y, GLAMO_2D_BAND);
+			GLAMOSetSurface(pGlamo, pPix, y, TRUE);
+			GLAMOSolidRect(pGlamo, x1, 0, x2 - x1, h);
+		}
+	}
+
+	GLAMOKickCMDQ(pGlamo);
+}
+
 void
 GLAMOExaDoneSolid(PixmapPtr pPix)
 {
 	ScrnInfoPtr pScrn = xf86Screens[pPix->drawable.pScreen->myNum];
 	GlamoPtr pGlamo = GlamoPTR(pScrn);
-    GLAMODispatchCMDQ(pGlamo);
+	GLAMO_TIMING_EMIT_END();
+    GLAMOFlushCMDQ(pGlamo);
+	GLAMOEndOp(pGlamo);
 	exaMarkSync(pGlamo->pScreen);
 }
 
@@ -370,6 +596,7 @@ GLAMOExaPrepareCopy(PixmapPtr       pSrc,
 	GlamoPtr pGlamo = GlamoPTR(pScrn);
 
     RING_LOCALS;
+    GLAMO_TIMING_LOCAL(start);
 
     FbBits mask;
 
@@ -377,13 +604,16 @@ GLAMOExaPrepareCopy(PixmapPtr       pSrc,
     CARD16 src_pitch, dst_pitch;
     CARD16 op;
 
+	GLAMO_TIMING_BEGIN(start);
 	if (pSrc->drawable.bitsPerPixel != 16 ||
 	    pDst->drawable.bitsPerPixel != 16)
-		GLAMO_FALLBACK(("Only 16bpp is supported"));
+		GLAMO_FALLBACK(GLAMO_FALLBACK_BPP,
+			       ("Only 16bpp is supported"));
 
 	mask = FbFullMask(16);
 	if ((pm & mask) != mask) {
-		GLAMO_FALLBACK(("Can't do planemask 0x%08x",
+		GLAMO_FALLBACK(GLAMO_FALLBACK_PLANEMASK,
+			       ("Can't do planemask 0x%08x",
 				(unsigned int) pm));
 	}
 
@@ -393,7 +623,15 @@ GLAMOExaPrepareCopy(PixmapPtr       pSrc,
 	dst_offset = exaGetPixmapOffset(pDst);
 	dst_pitch = exaGetPixmapPitch(pDst);
 
+	if (src_pitch > GLAMO_2D_MAX_PITCH || dst_pitch > GLAMO_2D_MAX_PITCH)
+		GLAMO_FALLBACK(GLAMO_FALLBACK_SIZE,
+			       ("Pitch %d/%d is too wide\n",
+				src_pitch, dst_pitch));
+
 	op = GLAMOBltRop[alu] << 8;
+	pGlamo->copy_src = pSrc;
+	GLAMOQueuePixmap(pGlamo, pSrc);
+	GLAMOQueuePixmap(pGlamo, pDst);
 
     BEGIN_CMDQ(20);
     OUT_REG(GLAMO_REG_2D_SRC_ADDRL, src_offset & 0xffff);
@@ -403,17 +641,36 @@ GLAMOExaPrepareCopy(PixmapPtr       pSrc,
 	OUT_REG(GLAMO_REG_2D_DST_ADDRL, dst_offset & 0xffff);
 	OUT_REG(GLAMO_REG_2D_DST_ADDRH, (dst_offset >> 16) & 0x7f);
 	OUT_REG(GLAMO_REG_2D_DST_PITCH, dst_pitch & 0x7ff);
-	OUT_REG(GLAMO_REG_2D_DST_HEIGHT, pDst->drawable.height);
+	OUT_REG(GLAMO_REG_2D_DST_HEIGHT,
+		min(pDst->drawable.height, GLAMO_2D_MAX_COORD));
 
 	OUT_REG(GLAMO_REG_2D_COMMAND2, op);
 	OUT_REG(GLAMO_REG_2D_ID1, 0);
 	OUT_REG(GLAMO_REG_2D_ID2, 0);
 	END_CMDQ();
 
-
+	GLAMO_TIMING_END(start, GLAMO_PHASE_PREPARE);
+	GLAMO_TIMING_EMIT_BEGIN();
 	return TRUE;
 }
 
+static void
+GLAMOCopyRect(GlamoPtr pGlamo, int srcX, int srcY, int dstX, int dstY,
+	      int width, int height)
+{
+	RING_LOCALS;
+
+	BEGIN_CMDQ(14);
+	OUT_REG(GLAMO_REG_2D_SRC_X, srcX);
+	OUT_REG(GLAMO_REG_2D_SRC_Y, srcY);
+	OUT_REG(GLAMO_REG_2D_DST_X, dstX);
+	OUT_REG(GLAMO_REG_2D_DST_Y, dstY);
+	OUT_REG(GLAMO_REG_2D_RECT_WIDTH, width);
+	OUT_REG(GLAMO_REG_2D_RECT_HEIGHT, height);
+	OUT_REG(GLAMO_REG_2D_COMMAND3, 0);
+	END_CMDQ();
+}
+
 void
 GLAMOExaCopy(PixmapPtr       pDst,
 	      int    srcX,
@@ -425,18 +682,45 @@ GLAMOExaCopy(PixmapPtr       pDst,
 {
 	ScrnInfoPtr pScrn = xf86Screens[pDst->drawable.pScreen->myNum];
 	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	PixmapPtr pSrc = pGlamo->copy_src;
+	int done, off, n, sy, dy, sbase, dbase;
+	Bool upwards;
 
-	RING_LOCALS;
-	BEGIN_CMDQ(14);
+	GLAMO_STAT_OP(pGlamo, GLAMO_STAT_COPY);
 
-	OUT_REG(GLAMO_REG_2D_SRC_X, srcX);
-	OUT_REG(GLAMO_REG_2D_SRC_Y, srcY);
-	OUT_REG(GLAMO_REG_2D_DST_X, dstX);
-	OUT_REG(GLAMO_REG_2D_DST_Y, dstY);
-	OUT_REG(GLAMO_REG_2D_RECT_WIDTH, width);
-	OUT_REG(GLAMO_REG_2D_RECT_HEIGHT, height);
-	OUT_REG(GLAMO_REG_2D_COMMAND3, 0);
-	END_CMDQ();
+	if (pSrc->drawable.height <= GLAMO_2D_MAX_COORD &&
+	    pDst->drawable.height <= GLAMO_2D_MAX_COORD) {
+		GLAMOCopyRect(pGlamo, srcX, srcY, dstX, dstY, width, height);
+		GLAMOKickCMDQ(pGlamo);
+		return;
+	}
+
+	/* Copy in bands, each with the surfaces moved to its first row.  If
+	 * the copy moves rows down within a pixmap, go from the bottom up so
+	 * no row is overwritten before it has been read.  Where a band may
+	 * overlap itself, source and destination share a base row, so that
+	 * the engine sees the overlap and picks its direction as usual. */
+	upwards = pSrc == pDst && dstY > srcY;
+	for (done = 0; done < height; done += n) {
+		n = min(height - done, GLAMO_2D_BAND);
+		off = upwards ? height - done - n : done;
+		sy = srcY + off;
+		dy = dstY + off;
+
+		if (pSrc == pDst && abs(sy - dy) < GLAMO_2D_BAND) {
+			sbase = dbase = min(sy, dy);
+		} else {
+			sbase = sy;
+			dbase = dy;
+		}
+
+		GLAMOSetSurface(pGlamo, pSrc, sbase, FALSE);
+		GLAMOSetSurface(pGlamo, pDst, dbase, TRUE);
+		GLAMOCopyRect(pGlamo, srcX, sy - sbase, dstX, dy - dbase,
+			      width, n);
+	}
+
+	GLAMOKickCMDQ(pGlamo);
 }
 
 void
@@ -444,7 +728,9 @@ GLAMOExaDoneCopy(PixmapPtr pDst)
 {
 	ScrnInfoPtr pScrn = xf86Screens[pDst->drawable.pScreen->myNum];
 	GlamoPtr pGlamo = GlamoPTR(pScrn);
-    GLAMODispatchCMDQ(pGlamo);
+	GLAMO_TIMING_EMIT_END();
+    GLAMOFlushCMDQ(pGlamo);
+	GLAMOEndOp(pGlamo);
 	exaMarkSync(pGlamo->pScreen);
 }
 
@@ -454,7 +740,15 @@ GLAMOExaCheckComposite(int op,
 		       PicturePtr   pMaskPicture,
 		       PicturePtr   pDstPicture)
 {
-	return FALSE;
+	ScreenPtr pScreen = pDstPicture->pDrawable->pScreen;
+	GlamoPtr pGlamo = GlamoPTR(xf86Screens[pScreen->myNum]);
+
+	if (GLAMOCompositeCheck(op, pSrcPicture, pMaskPicture, pDstPicture) ==
+	    GLAMO_COMPOSITE_NONE)
+		GLAMO_FALLBACK(GLAMO_FALLBACK_COMPOSITE,
+			       ("Composite op %i\n", op));
+
+	return TRUE;
 }
 
 Bool
@@ -466,7 +760,37 @@ GLAMOExaPrepareComposite(int                op,
 			 PixmapPtr          pMask,
 			 PixmapPtr          pDst)
 {
-	return FALSE;
+	ScrnInfoPtr pScrn = xf86Screens[pDst->drawable.pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	unsigned char *src;
+	CARD32 pixel = 0;
+	Pixel fill;
+
+	pGlamo->composite = GLAMOCompositeCheck(op, pSrcPicture, pMaskPicture,
+						pDstPicture);
+	switch (pGlamo->composite) {
+	case GLAMO_COMPOSITE_COPY:
+		return GLAMOExaPrepareCopy(pSrc, pDst, 0, 0, GXcopy,
+					   FB_ALLONES);
+
+	case GLAMO_COMPOSITE_FILL:
+		/* Read the colour of a 1x1 source */
+		if (pSrc && pSrcPicture->pDrawable && op != PictOpClear) {
+			GLAMOWaitPixmap(pGlamo, pSrc);
+			src = pGlamo->exa->memoryBase + exaGetPixmapOffset(pSrc);
+			if (pSrc->drawable.bitsPerPixel == 32)
+				pixel = *(CARD32 *)src;
+			else
+				pixel = *(CARD16 *)src;
+		}
+		if (!GLAMOCompositeFill(op, pSrcPicture, pixel, &fill))
+			GLAMO_FALLBACK(GLAMO_FALLBACK_COMPOSITE,
+				       ("Translucent solid source\n"));
+		return GLAMOExaPrepareSolid(pDst, GXcopy, FB_ALLONES, fill);
+
+	default:
+		return FALSE;
+	}
 }
 
 void
@@ -480,11 +804,76 @@ GLAMOExaComposite(PixmapPtr pDst,
 		 int width,
 		 int height)
 {
+	ScrnInfoPtr pScrn = xf86Screens[pDst->drawable.pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+
+	if (pGlamo->composite == GLAMO_COMPOSITE_COPY)
+		GLAMOExaCopy(pDst, srcX, srcY, dstX, dstY, width, height);
+	else
+		GLAMOExaSolid(pDst, dstX, dstY, dstX + width, dstY + height);
 }
 
 void
 GLAMOExaDoneComposite(PixmapPtr pDst)
 {
+	ScrnInfoPtr pScrn = xf86Screens[pDst->drawable.pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+
+	if (pGlamo->composite == GLAMO_COMPOSITE_COPY)
+		GLAMOExaDoneCopy(pDst);
+	else
+		GLAMOExaDoneSolid(pDst);
+}
+
+/* Write an upload to the staging area and queue a blit from there to the
+ * pixmap, behind the commands which still use it, instead of waiting for
+ * them.  Returns FALSE if the blitter can't do it. */
+static Bool
+GLAMOStagedUpload(GlamoPtr pGlamo, PixmapPtr pDst, int x, int y, int w,
+		  int h, char *src, int src_pitch)
+{
+	CARD32 offset, dst_offset;
+	CARD16 pitch, dst_pitch;
+	RING_LOCALS;
+
+	pitch = w * 2;
+	dst_pitch = exaGetPixmapPitch(pDst);
+	if (pDst->drawable.bitsPerPixel != 16 ||
+	    dst_pitch > GLAMO_2D_MAX_PITCH || h > GLAMO_2D_MAX_COORD ||
+	    (size_t)pitch * h > pGlamo->staging_size)
+		return FALSE;
+
+	offset = GLAMOStagingAlloc(pGlamo, pitch * h);
+	GlamoCopyRows(pGlamo->exa->memoryBase + offset, pitch,
+		      (unsigned char *)src, src_pitch, pitch, h);
+
+	GLAMOQueuePixmap(pGlamo, pDst);
+
+	/* The destination starts at row y, so tall pixmaps need no bands */
+	dst_offset = exaGetPixmapOffset(pDst) + y * dst_pitch;
+
+	BEGIN_CMDQ(20);
+	OUT_REG(GLAMO_REG_2D_SRC_ADDRL, offset & 0xffff);
+	OUT_REG(GLAMO_REG_2D_SRC_ADDRH, (offset >> 16) & 0x7f);
+	OUT_REG(GLAMO_REG_2D_SRC_PITCH, pitch & 0x7ff);
+	OUT_REG(GLAMO_REG_2D_DST_ADDRL, dst_offset & 0xffff);
+	OUT_REG(GLAMO_REG_2D_DST_ADDRH, (dst_offset >> 16) & 0x7f);
+	OUT_REG(GLAMO_REG_2D_DST_PITCH, dst_pitch & 0x7ff);
+	OUT_REG(GLAMO_REG_2D_DST_HEIGHT,
+		min(pDst->drawable.height - y, GLAMO_2D_MAX_COORD));
+	OUT_REG(GLAMO_REG_2D_COMMAND2, GLAMOBltRop[GXcopy] << 8);
+	OUT_REG(GLAMO_REG_2D_ID1, 0);
+	OUT_REG(GLAMO_REG_2D_ID2, 0);
+	END_CMDQ();
+	GLAMOCopyRect(pGlamo, 0, 0, x, 0, w, h);
+	GLAMOEndOp(pGlamo);
+
+	/* Left queued for the next batch; EXA will dispatch it before the CPU
+	 * next needs the engine to be idle */
+	exaMarkSync(pGlamo->pScreen);
+	GLAMO_STAT_OP(pGlamo, GLAMO_STAT_STAGED_UPLOAD);
+
+	return TRUE;
 }
 
 Bool
@@ -498,22 +887,30 @@ GLAMOExaUploadToScreen(PixmapPtr pDst,
 {
     ScrnInfoPtr pScrn = xf86Screens[pDst->drawable.pScreen->myNum];
     GlamoPtr pGlamo = GlamoPTR(pScrn);
-    int bpp, i;
+    int bpp;
     CARD8 *dst_offset;
     int dst_pitch;
+    CARD32 start;
 
-    exaWaitSync(pScrn->pScreen);
+    GLAMO_STAT_OP(pGlamo, GLAMO_STAT_UPLOAD);
+
+    /* Writing directly is cheapest, unless the engine still uses the
+     * pixmap */
+    start = exaGetPixmapOffset(pDst);
+    if (GLAMORangeBusy(pGlamo, start, start + exaGetPixmapPitch(pDst)
+                                          * pDst->drawable.height) &&
+        GLAMOStagedUpload(pGlamo, pDst, x, y, w, h, src, src_pitch))
+        return TRUE;
+
+    GLAMOWaitPixmap(pGlamo, pDst);
 
     bpp = pDst->drawable.bitsPerPixel / 8;
     dst_pitch = exaGetPixmapPitch(pDst);
     dst_offset = pGlamo->exa->memoryBase + exaGetPixmapOffset(pDst)
                     + x*bpp + y*dst_pitch;
 
-    for (i = 0; i < h; i++) {
-        memcpy(dst_offset, src, w*bpp);
-        dst_offset += dst_pitch;
-        src += src_pitch;
-    }
+    GlamoCopyRows(dst_offset, dst_pitch, (unsigned char *)src, src_pitch,
+                  w * bpp, h);
 
     return TRUE;
 }
@@ -527,23 +924,48 @@ GLAMOExaDownloadFromScreen(PixmapPtr pSrc,
 {
     ScrnInfoPtr pScrn = xf86Screens[pSrc->drawable.pScreen->myNum];
     GlamoPtr pGlamo = GlamoPTR(pScrn);
-    int bpp, i;
-    CARD8 *dst_offset, *src;
+    int bpp;
+    CARD8 *src;
     int src_pitch;
 
-    exaWaitSync(pScrn->pScreen);
+    GLAMO_STAT_OP(pGlamo, GLAMO_STAT_DOWNLOAD);
+    GLAMOWaitPixmap(pGlamo, pSrc);
 
     bpp = pSrc->drawable.bitsPerPixel / 8;
     src_pitch = exaGetPixmapPitch(pSrc);
     src = pGlamo->exa->memoryBase + exaGetPixmapOffset(pSrc) +
             x*bpp + y*src_pitch;
-    dst_offset = (unsigned char*)dst;
 
-    for (i = 0; i < h; i++) {
-        memcpy(dst_offset, src, w*bpp);
-        dst_offset += dst_pitch;
-        src += src_pitch;
-    }
+    GlamoCopyRows((unsigned char *)dst, dst_pitch, src, src_pitch,
+                  w * bpp, h);
+
+    return TRUE;
+}
+
+/* Move a pixmap from system memory to the staging area for a single use
+ * as the source of an operation, without giving it a place in the heap */
+Bool
+GLAMOExaUploadToScratch(PixmapPtr pSrc, PixmapPtr pDst)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pSrc->drawable.pScreen->myNum];
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+    int width, pitch;
+    CARD32 offset;
+
+    width = (pSrc->drawable.width * pSrc->drawable.bitsPerPixel + 7) / 8;
+    pitch = (width + 1) & ~1;
+    if ((size_t)pitch * pSrc->drawable.height > pGlamo->staging_size)
+        return FALSE;
+
+    GLAMO_STAT_OP(pGlamo, GLAMO_STAT_UPLOAD);
+    offset = GLAMOStagingAlloc(pGlamo, pitch * pSrc->drawable.height);
+    GlamoCopyRows(pGlamo->exa->memoryBase + offset, pitch,
+                  pSrc->devPrivate.ptr, pSrc->devKind, width,
+                  pSrc->drawable.height);
+
+    *pDst = *pSrc;
+    pDst->devKind = pitch;
+    pDst->devPrivate.ptr = pGlamo->exa->memoryBase + offset;
 
     return TRUE;
 }
@@ -555,5 +977,6 @@ GLAMOExaWaitMarker (ScreenPtr pScreen, int marker)
 	GlamoPtr pGlamo = GlamoPTR(pScrn);
     GLAMODispatchCMDQ(pGlamo);
 	GLAMOEngineWait(pGlamo, GLAMO_ENGINE_ALL);
+	pGlamo->busy_start = pGlamo->busy_end = 0;
 }
 
@@ -31,15 +31,21 @@ void GLAMOWaitIdle(GlamoPtr *pGlamo);
 #define GLAMO_TRACE_FALL 0
 #define GLAMO_TRACE_DRAW 1
 
+/* Decline an operation, counting the reason in pGlamo->stats */
 #if GLAMO_TRACE_FALL
-#define GLAMO_FALLBACK(x)			\
+#define GLAMO_FALLBACK(reason, x)		\
 do {					\
+	pGlamo->stats.fallbacks[reason]++;	\
 	ErrorF("%s: ", __FUNCTION__);	\
 	ErrorF x;			\
 	return FALSE;			\
 } while (0)
 #else
-#define GLAMO_FALLBACK(x) return FALSE
+#define GLAMO_FALLBACK(reason, x)		\
+do {					\
+	pGlamo->stats.fallbacks[reason]++;	\
+	return FALSE;			\
+} while (0)
 #endif
 
 #if GLAMO_TRACE_DRAW
@@ -72,15 +72,24 @@
 #include <xf86.h>
 #include <xf86_OSproc.h>
 #include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <xf86Crtc.h>
 #include <dri2.h>
+#include <resource.h>
+#include <dixstruct.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
 #include <glamo_bo_gem.h>
 
 #include "glamo.h"
 #include "glamo-dri2.h"
 #include "glamo-kms-exa.h"
+#include "glamo-drm.h"
+#include "glamo-kms-crtc.h"
 
 
 struct glamo_dri2_buffer_priv {
@@ -89,6 +98,283 @@ struct glamo_dri2_buffer_priv {
 };
 
 
+#if DRI2INFOREC_VERSION >= 4
+
+enum glamo_dri2_event_type {
+	GLAMO_DRI2_SWAP,	/* Waiting for the vblank before a swap */
+	GLAMO_DRI2_FLIP,	/* Waiting for a page flip to complete */
+	GLAMO_DRI2_WAITMSC,	/* Waiting for the vblank of a WaitMSC */
+	GLAMO_DRI2_DONE,	/* Already handled, waiting for the event */
+};
+
+/* How long to wait for each outstanding event when the screen closes, in
+ * milliseconds: a few frames */
+#define GLAMO_DRI2_DRAIN_TIMEOUT 100
+
+/* A request waiting for an event from the kernel.  It is a resource of the
+ * client which made it, so that client is forgotten if it goes first. */
+struct glamo_dri2_swap_info {
+	enum glamo_dri2_event_type type;
+	ScrnInfoPtr pScrn;
+	XID drawable_id;
+	ClientPtr client;
+	XID client_id;
+	DRI2BufferPtr front;
+	DRI2BufferPtr back;
+	DRI2SwapEventPtr event_func;
+	void *event_data;
+	CARD64 target_msc;
+	unsigned int old_fb_id;
+	struct glamo_dri2_swap_info *next;
+};
+
+
+static RESTYPE glamo_dri2_swap_type;
+static unsigned long glamo_dri2_swap_generation;
+
+
+/* The client has gone: there is nobody left to tell when the request is
+ * complete, but a page flip still has to be seen through */
+static int glamoSwapInfoClientGone(pointer data, XID id)
+{
+	struct glamo_dri2_swap_info *info = data;
+
+	info->client = NULL;
+	if ( info->type != GLAMO_DRI2_FLIP ) info->type = GLAMO_DRI2_DONE;
+
+	return Success;
+}
+
+
+static void glamoSwapInfoFree(struct glamo_dri2_swap_info *info)
+{
+	GlamoPtr pGlamo = GlamoPTR(info->pScrn);
+	struct glamo_dri2_swap_info **pos;
+
+	if ( info->client ) {
+		FreeResourceByType(info->client_id, glamo_dri2_swap_type,
+		                   TRUE);
+	}
+
+	for ( pos=&pGlamo->dri2_swaps; *pos; pos=&(*pos)->next ) {
+		if ( *pos == info ) {
+			*pos = info->next;
+			break;
+		}
+	}
+
+	free(info);
+}
+
+
+static struct glamo_dri2_swap_info *glamoSwapInfoNew(ClientPtr client,
+                                             DrawablePtr drawable,
+                                             enum glamo_dri2_event_type type)
+{
+	ScrnInfoPtr pScrn = xf86Screens[drawable->pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	struct glamo_dri2_swap_info *info;
+
+	info = calloc(1, sizeof(*info));
+	if ( !info ) return NULL;
+
+	info->type = type;
+	info->pScrn = pScrn;
+	info->drawable_id = drawable->id;
+	info->client = client;
+	info->client_id = FakeClientID(client->index);
+	info->next = pGlamo->dri2_swaps;
+	pGlamo->dri2_swaps = info;
+
+	/* On failure, this calls glamoSwapInfoClientGone() */
+	if ( !AddResource(info->client_id, glamo_dri2_swap_type, info) ) {
+		glamoSwapInfoFree(info);
+		return NULL;
+	}
+
+	return info;
+}
+
+
+/* Make sure no outstanding request refers to a buffer which is going away */
+static void glamoSwapForgetBuffer(GlamoPtr pGlamo, DRI2BufferPtr buffer)
+{
+	struct glamo_dri2_swap_info *info;
+
+	for ( info=pGlamo->dri2_swaps; info; info=info->next ) {
+		if ( info->front == buffer ) info->front = NULL;
+		if ( info->back == buffer ) info->back = NULL;
+	}
+}
+
+#endif
+
+
+/* Auxiliary buffers (back, depth, fake front...) whose DRI2 buffers have been
+ * destroyed are kept for a while, so that a client which asks for a buffer
+ * of the same size and format again, typically after resizing back and forth
+ * or re-creating its drawable, gets the old one without any new allocation
+ * or GEM flink.  The flink name goes with the buffer, so it is only given
+ * back to the client which had it.  Buffers are freed when they have not
+ * been reused for GLAMO_DRI2_POOL_TIMEOUT milliseconds, by a timer while
+ * the pool is not empty, and all at once when video memory runs out. */
+#define GLAMO_DRI2_POOL_SIZE 4
+#define GLAMO_DRI2_POOL_TIMEOUT 2000
+
+struct glamo_dri2_pool_entry {
+	PixmapPtr pixmap;
+	unsigned int name;
+	unsigned int attachment;
+	XID drawable_id;
+	CARD32 time;
+	struct glamo_dri2_pool_entry *next;
+};
+
+
+/* Free pool entries which are too old, or all of them if "all" is set.
+ * Returns TRUE if any were freed. */
+static Bool glamoPoolExpire(ScreenPtr pScreen, Bool all)
+{
+	GlamoPtr pGlamo = GlamoPTR(xf86Screens[pScreen->myNum]);
+	struct glamo_dri2_pool_entry **pos;
+	CARD32 now = GetTimeInMillis();
+	Bool freed = FALSE;
+
+	pos = &pGlamo->dri2_pool;
+	while ( *pos ) {
+		struct glamo_dri2_pool_entry *entry = *pos;
+		if ( all || (now - entry->time) > GLAMO_DRI2_POOL_TIMEOUT ) {
+			*pos = entry->next;
+			pScreen->DestroyPixmap(entry->pixmap);
+			free(entry);
+			freed = TRUE;
+		} else {
+			pos = &entry->next;
+		}
+	}
+
+	return freed;
+}
+
+
+/* Expire old entries, and run again when the oldest left is due */
+static CARD32 glamoPoolTimer(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+	ScreenPtr pScreen = arg;
+	GlamoPtr pGlamo = GlamoPTR(xf86Screens[pScreen->myNum]);
+	struct glamo_dri2_pool_entry *entry;
+	CARD32 due, next = 0;
+
+	glamoPoolExpire(pScreen, FALSE);
+
+	/* Whatever is left is no older than the timeout */
+	now = GetTimeInMillis();
+	for ( entry=pGlamo->dri2_pool; entry; entry=entry->next ) {
+		due = GLAMO_DRI2_POOL_TIMEOUT + 1 - (now - entry->time);
+		if ( !next || due < next ) next = due;
+	}
+
+	return next;
+}
+
+
+/* Free every buffer in the pool, to make room in video memory.  Returns
+ * TRUE if there were any. */
+Bool driPoolRelease(ScreenPtr pScreen)
+{
+	return glamoPoolExpire(pScreen, TRUE);
+}
+
+
+/* Take a pixmap suitable for the given attachment out of the pool.
+ * A buffer previously used by the same drawable for the same attachment is
+ * preferred, otherwise any of the right size and depth which the same
+ * client had will do. */
+static PixmapPtr glamoPoolGet(DrawablePtr drawable, unsigned int attachment,
+                              unsigned int depth, unsigned int *name)
+{
+	ScreenPtr pScreen = drawable->pScreen;
+	GlamoPtr pGlamo = GlamoPTR(xf86Screens[pScreen->myNum]);
+	struct glamo_dri2_pool_entry **pos;
+	struct glamo_dri2_pool_entry **found = NULL;
+	struct glamo_dri2_pool_entry *entry;
+	PixmapPtr pixmap;
+
+	glamoPoolExpire(pScreen, FALSE);
+
+	for ( pos=&pGlamo->dri2_pool; *pos; pos=&(*pos)->next ) {
+		pixmap = (*pos)->pixmap;
+		if ( pixmap->drawable.width != drawable->width ) continue;
+		if ( pixmap->drawable.height != drawable->height ) continue;
+		if ( pixmap->drawable.depth != depth ) continue;
+		if ( CLIENT_ID((*pos)->drawable_id) != CLIENT_ID(drawable->id) )
+			continue;
+		if ( (*pos)->drawable_id == drawable->id
+		  && (*pos)->attachment == attachment ) {
+			found = pos;
+			break;
+		}
+		if ( !found ) found = pos;
+	}
+	if ( !found ) return NULL;
+
+	entry = *found;
+	*found = entry->next;
+	pixmap = entry->pixmap;
+	*name = entry->name;
+	free(entry);
+
+	return pixmap;
+}
+
+
+/* Put an auxiliary buffer's pixmap into the pool.  Returns FALSE if it
+ * couldn't be kept, in which case the caller should free it. */
+static Bool glamoPoolPut(DrawablePtr drawable, PixmapPtr pixmap,
+                         unsigned int name, unsigned int attachment)
+{
+	ScreenPtr pScreen = drawable->pScreen;
+	GlamoPtr pGlamo = GlamoPTR(xf86Screens[pScreen->myNum]);
+	struct glamo_dri2_pool_entry *entry;
+	struct glamo_dri2_pool_entry **pos;
+	int n = 0;
+
+	if ( pixmap->refcnt != 1 ) return FALSE;
+
+	glamoPoolExpire(pScreen, FALSE);
+
+	entry = malloc(sizeof(*entry));
+	if ( !entry ) return FALSE;
+	entry->pixmap = pixmap;
+	entry->name = name;
+	entry->attachment = attachment;
+	entry->drawable_id = drawable->id;
+	entry->time = GetTimeInMillis();
+	entry->next = pGlamo->dri2_pool;
+	pGlamo->dri2_pool = entry;
+
+	/* The timer runs for as long as the pool has anything in it */
+	if ( !entry->next ) {
+		pGlamo->dri2_pool_timer = TimerSet(pGlamo->dri2_pool_timer, 0,
+		                                   GLAMO_DRI2_POOL_TIMEOUT + 1,
+		                                   glamoPoolTimer, pScreen);
+	}
+
+	/* Drop the oldest entry if the pool is full */
+	for ( pos=&pGlamo->dri2_pool; *pos; pos=&(*pos)->next ) {
+		if ( ++n > GLAMO_DRI2_POOL_SIZE ) {
+			entry = *pos;
+			*pos = NULL;
+			pScreen->DestroyPixmap(entry->pixmap);
+			free(entry);
+			break;
+		}
+	}
+
+	return TRUE;
+}
+
+
 #if DRI2INFOREC_VERSION >= 3
 
 static DRI2BufferPtr glamoCreateBuffer(DrawablePtr drawable,
@@ -101,6 +387,7 @@ static DRI2BufferPtr glamoCreateBuffer(DrawablePtr drawable,
 	struct glamo_dri2_buffer_priv *private;
 	PixmapPtr pixmap;
 	struct glamo_exa_pixmap_priv *driver_priv;
+	unsigned int depth;
 	int r;
 
 	buffer = calloc(1, sizeof(*buffer));
@@ -121,27 +408,41 @@ static DRI2BufferPtr glamoCreateBuffer(DrawablePtr drawable,
 		}
 		pixmap->refcnt++;
 	} else {
-		pixmap = pScreen->CreatePixmap(pScreen,
-		                           drawable->width,
-		                           drawable->height,
-		                           (format != 0)?format:drawable->depth,
-		                           0);
-	}
-	exaMoveInPixmap(pixmap);
-	driver_priv = exaGetPixmapDriverPrivate(pixmap);
-	if ( !driver_priv ) {
-		free(buffer);
-		free(private);
-		return NULL;
+		depth = (format != 0)?format:drawable->depth;
+		pixmap = glamoPoolGet(drawable, attachment, depth,
+		                      &buffer->name);
+		if ( !pixmap ) {
+			pixmap = pScreen->CreatePixmap(pScreen,
+			                               drawable->width,
+			                               drawable->height,
+			                               depth, 0);
+		}
+		if ( !pixmap ) {
+			free(buffer);
+			free(private);
+			return NULL;
+		}
 	}
-	r = glamo_gem_name_buffer(driver_priv->bo, &buffer->name);
-	if (r) {
-		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
-		           "Couldn't name buffer: %d %s\n",
-		           r, strerror(r));
-		free(buffer);
-		free(private);
-		return NULL;
+	if ( !buffer->name ) {
+		exaMoveInPixmap(pixmap);
+		driver_priv = exaGetPixmapDriverPrivate(pixmap);
+		if ( !driver_priv || !GlamoKMSExaExportPixmap(pixmap) ) {
+			/* Also drops the reference taken on a front buffer */
+			pScreen->DestroyPixmap(pixmap);
+			free(buffer);
+			free(private);
+			return NULL;
+		}
+		r = glamo_gem_name_buffer(driver_priv->bo, &buffer->name);
+		if (r) {
+			xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+			           "Couldn't name buffer: %d %s\n",
+			           r, strerror(r));
+			pScreen->DestroyPixmap(pixmap);
+			free(buffer);
+			free(private);
+			return NULL;
+		}
 	}
 	buffer->attachment = attachment;
 	buffer->pitch = pixmap->devKind;
@@ -190,27 +491,34 @@ static DRI2BufferPtr glamoCreateBuffers(DrawablePtr drawable,
 			}
 			pixmap->refcnt++;
 		} else {
-			pixmap = pScreen->CreatePixmap(pScreen,
-				           drawable->width,
-				           drawable->height,
-				           drawable->depth,
-				           0);
-		}
-		exaMoveInPixmap(pixmap);
-		driver_priv = exaGetPixmapDriverPrivate(pixmap);
-		if ( !driver_priv ) {
-			free(buffers);
-			free(privates);
-			return NULL;
+			pixmap = glamoPoolGet(drawable, attachments[i],
+			                      drawable->depth,
+			                      &buffers[i].name);
+			if ( !pixmap ) {
+				pixmap = pScreen->CreatePixmap(pScreen,
+					           drawable->width,
+					           drawable->height,
+					           drawable->depth,
+					           0);
+			}
+			if ( !pixmap ) goto fail;
 		}
-		r = glamo_gem_name_buffer(driver_priv->bo, &buffers[i].name);
-		if (r) {
-			xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
-			           "Couldn't name buffer: %d %s\n",
-			           r, strerror(r));
-			free(buffers);
-			free(privates);
-			return NULL;
+		if ( !buffers[i].name ) {
+			exaMoveInPixmap(pixmap);
+			driver_priv = exaGetPixmapDriverPrivate(pixmap);
+			if ( !driver_priv || !GlamoKMSExaExportPixmap(pixmap) ) {
+				pScreen->DestroyPixmap(pixmap);
+				goto fail;
+			}
+			r = glamo_gem_name_buffer(driver_priv->bo,
+			                          &buffers[i].name);
+			if (r) {
+				xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+				           "Couldn't name buffer: %d %s\n",
+				           r, strerror(r));
+				pScreen->DestroyPixmap(pixmap);
+				goto fail;
+			}
 		}
 		buffers[i].attachment = attachments[i];
 		buffers[i].pitch = pixmap->devKind;
@@ -224,6 +532,13 @@ static DRI2BufferPtr glamoCreateBuffers(DrawablePtr drawable,
 	}
 
 	return buffers;
+
+fail:
+	/* Release the pixmaps of the buffers already made, front included */
+	while ( i-- > 0 ) pScreen->DestroyPixmap(privates[i].pixmap);
+	free(buffers);
+	free(privates);
+	return NULL;
 }
 
 #endif
@@ -237,7 +552,15 @@ static void glamoDestroyBuffer(DrawablePtr pDraw,
 	struct glamo_dri2_buffer_priv *private;
 
 	private = buffer->driverPrivate;
-	pScreen->DestroyPixmap(private->pixmap);
+	if ( private->attachment == DRI2BufferFrontLeft
+	  || !glamoPoolPut(pDraw, private->pixmap, buffer->name,
+	                   private->attachment) ) {
+		pScreen->DestroyPixmap(private->pixmap);
+	}
+
+#if DRI2INFOREC_VERSION >= 4
+	glamoSwapForgetBuffer(GlamoPTR(xf86Screens[pScreen->myNum]), buffer);
+#endif
 
 	if ( buffer ) {
 		free(buffer->driverPrivate);
@@ -253,9 +576,13 @@ static void glamoDestroyBuffers(DrawablePtr pDraw,
 	int i;
 
 	for ( i=0; i<count; i++ ) {
-		GlamoDRI2BufferPrivatePtr private;
+		struct glamo_dri2_buffer_priv *private;
 		private = buffers[i].driverPrivate;
-		pScreen->DestroyPixmap(private->pixmap);
+		if ( private->attachment == DRI2BufferFrontLeft
+		  || !glamoPoolPut(pDraw, private->pixmap, buffers[i].name,
+		                   private->attachment) ) {
+			pScreen->DestroyPixmap(private->pixmap);
+		}
 	}
 
 	if ( buffers ) {
@@ -267,40 +594,586 @@ static void glamoDestroyBuffers(DrawablePtr pDraw,
 #endif
 
 
-static void glamoCopyRegion(DrawablePtr drawable, RegionPtr region,
-                            DRI2BufferPtr dst_buffer, DRI2BufferPtr src_buffer)
+/* Find the pixmap behind a DRI2 buffer, and the offset from drawable
+ * coordinates to the coordinates of that pixmap */
+static PixmapPtr glamoBufferPixmap(DrawablePtr drawable, DRI2BufferPtr buffer,
+                                   int *dx, int *dy)
+{
+	struct glamo_dri2_buffer_priv *private = buffer->driverPrivate;
+	PixmapPtr pixmap;
+
+	*dx = 0;
+	*dy = 0;
+
+	if ( private->attachment != DRI2BufferFrontLeft ) return private->pixmap;
+	if ( drawable->type == DRAWABLE_PIXMAP ) return (PixmapPtr)drawable;
+
+	pixmap = drawable->pScreen->GetWindowPixmap((WindowPtr)drawable);
+#ifdef COMPOSITE
+	*dx = drawable->x - pixmap->screen_x;
+	*dy = drawable->y - pixmap->screen_y;
+#else
+	*dx = drawable->x;
+	*dy = drawable->y;
+#endif
+
+	return pixmap;
+}
+
+
+/* Copy the old way, with a GC.  Only used if the blitter can't do it. */
+static void glamoCopyRegionGC(DrawablePtr drawable, RegionPtr region,
+                              DRI2BufferPtr dst_buffer, DRI2BufferPtr src_buffer)
 {
 	struct glamo_dri2_buffer_priv *src_private;
 	struct glamo_dri2_buffer_priv *dst_private;
 	ScreenPtr pScreen = drawable->pScreen;
-	PixmapPtr src_pixmap;
-	PixmapPtr dst_pixmap;
+	DrawablePtr src_drawable;
+	DrawablePtr dst_drawable;
 	RegionPtr copy_clip;
 	GCPtr gc;
 
 	src_private = src_buffer->driverPrivate;
 	dst_private = dst_buffer->driverPrivate;
-	src_pixmap = src_private->pixmap;
-	dst_pixmap = dst_private->pixmap;
+	src_drawable = &src_private->pixmap->drawable;
+	dst_drawable = &dst_private->pixmap->drawable;
 
 	if (src_private->attachment == DRI2BufferFrontLeft) {
-		src_pixmap = (PixmapPtr)drawable;
+		src_drawable = drawable;
 	}
 	if (dst_private->attachment == DRI2BufferFrontLeft) {
-		dst_pixmap = (PixmapPtr)drawable;
+		dst_drawable = drawable;
 	}
 
 	gc = GetScratchGC(drawable->depth, pScreen);
 	copy_clip = REGION_CREATE(pScreen, NULL, 0);
 	REGION_COPY(pScreen, copy_clip, region);
 	gc->funcs->ChangeClip(gc, CT_REGION, copy_clip, 0);
-	ValidateGC(&dst_pixmap->drawable, gc);
-	gc->ops->CopyArea(&src_pixmap->drawable, &dst_pixmap->drawable, gc,
+	ValidateGC(dst_drawable, gc);
+	gc->ops->CopyArea(src_drawable, dst_drawable, gc,
 		         0, 0, drawable->width, drawable->height, 0, 0);
 	FreeScratchGC(gc);
 }
 
 
+/* Copy only the boxes of the damaged region, straight to the blitter */
+static void glamoCopyRegion(DrawablePtr drawable, RegionPtr region,
+                            DRI2BufferPtr dst_buffer, DRI2BufferPtr src_buffer)
+{
+	ScreenPtr pScreen = drawable->pScreen;
+	struct glamo_dri2_buffer_priv *dst_private;
+	PixmapPtr src_pixmap;
+	PixmapPtr dst_pixmap;
+	int src_dx, src_dy;
+	int dst_dx, dst_dy;
+	RegionRec clip;
+	BoxRec bounds;
+	Bool ok;
+
+	src_pixmap = glamoBufferPixmap(drawable, src_buffer, &src_dx, &src_dy);
+	dst_pixmap = glamoBufferPixmap(drawable, dst_buffer, &dst_dx, &dst_dy);
+	dst_private = dst_buffer->driverPrivate;
+
+	/* Limit the copy to the drawable, and to the visible part of the
+	 * window if we are drawing to the real front buffer */
+	bounds.x1 = 0;
+	bounds.y1 = 0;
+	bounds.x2 = drawable->width;
+	bounds.y2 = drawable->height;
+	REGION_INIT(pScreen, &clip, &bounds, 1);
+	REGION_INTERSECT(pScreen, &clip, &clip, region);
+
+	if ( dst_private->attachment == DRI2BufferFrontLeft
+	  && drawable->type == DRAWABLE_WINDOW ) {
+		REGION_TRANSLATE(pScreen, &clip, drawable->x, drawable->y);
+		REGION_INTERSECT(pScreen, &clip, &clip,
+		                 &((WindowPtr)drawable)->clipList);
+		REGION_TRANSLATE(pScreen, &clip, -drawable->x, -drawable->y);
+	}
+
+	REGION_TRANSLATE(pScreen, &clip, dst_dx, dst_dy);
+
+	ok = GlamoKMSExaCopyBoxes(src_pixmap, dst_pixmap,
+	                          REGION_RECTS(&clip), REGION_NUM_RECTS(&clip),
+	                          src_dx - dst_dx, src_dy - dst_dy);
+	REGION_UNINIT(pScreen, &clip);
+
+	/* The client renders to its buffers as soon as it hears back, so
+	 * the copy must reach the kernel first */
+	GlamoDRMDrain(GlamoPTR(xf86Screens[pScreen->myNum]));
+
+	if ( !ok ) glamoCopyRegionGC(drawable, region, dst_buffer, src_buffer);
+}
+
+
+#if DRI2INFOREC_VERSION >= 4
+
+/* Return TRUE if the swap can be done by scanning out the back buffer
+ * instead of copying it to the front buffer */
+static Bool glamoCanFlip(DrawablePtr drawable, DRI2BufferPtr front_buffer,
+                         DRI2BufferPtr back_buffer)
+{
+	ScreenPtr pScreen = drawable->pScreen;
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	PixmapPtr root = pScreen->GetScreenPixmap(pScreen);
+	struct glamo_dri2_buffer_priv *front_private;
+	struct glamo_dri2_buffer_priv *back_private;
+	PixmapPtr back_pixmap;
+	RegionPtr clip;
+	BoxPtr box;
+
+	front_private = front_buffer->driverPrivate;
+	back_private = back_buffer->driverPrivate;
+	back_pixmap = back_private->pixmap;
+
+	if ( !pScrn->vtSema || pGlamo->dri2_flip_pending ) return FALSE;
+	if ( drawable->type != DRAWABLE_WINDOW ) return FALSE;
+	if ( front_private->pixmap != root ) return FALSE;
+
+	/* The window has to cover the whole screen, unobscured */
+	if ( drawable->x != 0 || drawable->y != 0 ) return FALSE;
+	if ( drawable->width != root->drawable.width ) return FALSE;
+	if ( drawable->height != root->drawable.height ) return FALSE;
+	clip = &((WindowPtr)drawable)->clipList;
+	if ( REGION_NUM_RECTS(clip) != 1 ) return FALSE;
+	box = REGION_EXTENTS(pScreen, clip);
+	if ( box->x1 != 0 || box->y1 != 0 ||
+	     box->x2 != root->drawable.width ||
+	     box->y2 != root->drawable.height ) return FALSE;
+
+	/* ...and the back buffer has to be in the scan-out format */
+	if ( back_pixmap->drawable.depth != root->drawable.depth ) return FALSE;
+	if ( back_pixmap->drawable.bitsPerPixel
+	      != root->drawable.bitsPerPixel ) return FALSE;
+	if ( back_pixmap->devKind != root->devKind ) return FALSE;
+
+	return TRUE;
+}
+
+
+/* Point the CRTC at the back buffer and exchange the front and back buffer
+ * objects, so that the front pixmap is always the one being displayed */
+static Bool glamoScheduleFlip(DrawablePtr drawable, DRI2BufferPtr front_buffer,
+                              DRI2BufferPtr back_buffer,
+                              struct glamo_dri2_swap_info *info)
+{
+	ScreenPtr pScreen = drawable->pScreen;
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(pScrn);
+	xf86CrtcPtr crtc = NULL;
+	struct glamo_dri2_buffer_priv *front_private;
+	struct glamo_dri2_buffer_priv *back_private;
+	struct glamo_exa_pixmap_priv *front_exa;
+	struct glamo_exa_pixmap_priv *back_exa;
+	unsigned int tmp_name;
+	uint32_t new_fb_id;
+	int i;
+
+	for ( i=0; i<config->num_crtc; i++ ) {
+		if ( config->crtc[i]->enabled ) {
+			crtc = config->crtc[i];
+			break;
+		}
+	}
+	if ( !crtc ) return FALSE;
+
+	front_private = front_buffer->driverPrivate;
+	back_private = back_buffer->driverPrivate;
+	front_exa = exaGetPixmapDriverPrivate(front_private->pixmap);
+	back_exa = exaGetPixmapDriverPrivate(back_private->pixmap);
+	if ( !front_exa || !back_exa || !back_exa->bo ) return FALSE;
+
+	/* The kernel flips without waiting for rendering it hasn't seen */
+	GlamoDRMDrain(pGlamo);
+
+	if ( drmModeAddFB(pGlamo->drm_fd,
+	                  pScrn->virtualX, pScrn->virtualY,
+	                  pScrn->depth, pScrn->bitsPerPixel,
+	                  back_private->pixmap->devKind,
+	                  back_exa->bo->handle, &new_fb_id) ) {
+		return FALSE;
+	}
+
+	if ( drmModePageFlip(pGlamo->drm_fd, crtc_get_id(crtc), new_fb_id,
+	                     DRM_MODE_PAGE_FLIP_EVENT, info) ) {
+		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		           "[glamo-dri] Page flip failed: %s\n",
+		           strerror(errno));
+		drmModeRmFB(pGlamo->drm_fd, new_fb_id);
+		return FALSE;
+	}
+
+	info->old_fb_id = pGlamo->fb_id;
+	pGlamo->fb_id = new_fb_id;
+	pGlamo->dri2_flip_pending = TRUE;
+
+	GlamoKMSExaExchangeBOs(front_private->pixmap, back_private->pixmap);
+
+	tmp_name = front_buffer->name;
+	front_buffer->name = back_buffer->name;
+	back_buffer->name = tmp_name;
+
+	return TRUE;
+}
+
+
+/* Copy the whole back buffer to the front */
+static void glamoSwapBlit(DrawablePtr drawable, DRI2BufferPtr front_buffer,
+                          DRI2BufferPtr back_buffer)
+{
+	ScreenPtr pScreen = drawable->pScreen;
+	RegionRec region;
+	BoxRec box;
+
+	box.x1 = 0;
+	box.y1 = 0;
+	box.x2 = drawable->width;
+	box.y2 = drawable->height;
+	REGION_INIT(pScreen, &region, &box, 0);
+	glamoCopyRegion(drawable, &region, front_buffer, back_buffer);
+	REGION_UNINIT(pScreen, &region);
+}
+
+
+/* Read the current frame counter and the time at which it last changed */
+static Bool glamoGetVblank(ScrnInfoPtr pScrn, CARD64 *ust, CARD64 *msc)
+{
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	drmVBlank vbl;
+
+	vbl.request.type = DRM_VBLANK_RELATIVE;
+	vbl.request.sequence = 0;
+	if ( drmWaitVBlank(pGlamo->drm_fd, &vbl) ) {
+		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		           "[glamo-dri] Failed to read vblank counter: %s\n",
+		           strerror(errno));
+		return FALSE;
+	}
+
+	*ust = ((CARD64)vbl.reply.tval_sec * 1000000) + vbl.reply.tval_usec;
+	*msc = vbl.reply.sequence;
+	return TRUE;
+}
+
+
+/* Ask for an event on the DRM fd when the frame counter reaches msc */
+static Bool glamoQueueVblank(ScrnInfoPtr pScrn, CARD64 msc,
+                             struct glamo_dri2_swap_info *info)
+{
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	drmVBlank vbl;
+
+	vbl.request.type = DRM_VBLANK_ABSOLUTE | DRM_VBLANK_EVENT;
+	vbl.request.sequence = msc;
+	vbl.request.signal = (unsigned long)info;
+	if ( drmWaitVBlank(pGlamo->drm_fd, &vbl) ) {
+		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		           "[glamo-dri] Failed to queue vblank event: %s\n",
+		           strerror(errno));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+/* Carry out a swap, by flipping if possible and allow_flip is set.  A
+ * flip allowed at a frame before the target which can't be done after all
+ * is replaced by a blit at the target, rather than one straight away.
+ * Returns TRUE if info is still needed for a page flip or vblank. */
+static Bool glamoExecuteSwap(DrawablePtr drawable,
+                             struct glamo_dri2_swap_info *info,
+                             Bool allow_flip, unsigned int frame,
+                             unsigned int tv_sec, unsigned int tv_usec)
+{
+	if ( !info->front || !info->back ) {
+		/* One of the buffers was destroyed, nothing to swap */
+		allow_flip = FALSE;
+	} else if ( allow_flip
+	         && glamoCanFlip(drawable, info->front, info->back)
+	         && glamoScheduleFlip(drawable, info->front, info->back, info) ) {
+		info->type = GLAMO_DRI2_FLIP;
+		return TRUE;
+	} else if ( allow_flip && frame < info->target_msc
+	         && glamoQueueVblank(info->pScrn, info->target_msc, info) ) {
+		return TRUE;
+	} else {
+		glamoSwapBlit(drawable, info->front, info->back);
+	}
+
+	DRI2SwapComplete(info->client, drawable, frame, tv_sec, tv_usec,
+	                 DRI2_BLIT_COMPLETE, info->event_func, info->event_data);
+	return FALSE;
+}
+
+
+/* Work out the frame at which a request should be carried out, following
+ * the OML_sync_control rules for target_msc, divisor and remainder */
+static CARD64 glamoTargetMSC(CARD64 current_msc, CARD64 target_msc,
+                             CARD64 divisor, CARD64 remainder)
+{
+	if ( divisor == 0 || current_msc < target_msc ) {
+		return target_msc > current_msc ? target_msc : current_msc;
+	}
+
+	target_msc = current_msc - (current_msc % divisor) + remainder;
+	if ( target_msc <= current_msc ) target_msc += divisor;
+
+	return target_msc;
+}
+
+
+static void glamoVblankHandler(int fd, unsigned int frame, unsigned int tv_sec,
+                               unsigned int tv_usec, void *event_data)
+{
+	struct glamo_dri2_swap_info *info = event_data;
+	DrawablePtr drawable;
+	int r;
+
+	if ( info->type == GLAMO_DRI2_DONE ) {
+		glamoSwapInfoFree(info);
+		return;
+	}
+
+	r = dixLookupDrawable(&drawable, info->drawable_id, serverClient,
+	                      M_ANY, DixWriteAccess);
+	if ( r != Success ) {
+		glamoSwapInfoFree(info);
+		return;
+	}
+
+	switch ( info->type ) {
+	case GLAMO_DRI2_SWAP :
+		/* Only a vblank ahead of the target was asked for to flip at.
+		 * At the target itself, a flip would come a frame late. */
+		if ( glamoExecuteSwap(drawable, info, frame < info->target_msc,
+		                      frame, tv_sec, tv_usec) ) return;
+		break;
+	case GLAMO_DRI2_WAITMSC :
+		DRI2WaitMSCComplete(info->client, drawable,
+		                    frame, tv_sec, tv_usec);
+		break;
+	default :
+		break;
+	}
+
+	glamoSwapInfoFree(info);
+}
+
+
+static void glamoFlipHandler(int fd, unsigned int frame, unsigned int tv_sec,
+                             unsigned int tv_usec, void *event_data)
+{
+	struct glamo_dri2_swap_info *info = event_data;
+	GlamoPtr pGlamo = GlamoPTR(info->pScrn);
+	DrawablePtr drawable;
+	int r;
+
+	/* The old front buffer is no longer being scanned out */
+	if ( info->old_fb_id ) drmModeRmFB(fd, info->old_fb_id);
+	pGlamo->dri2_flip_pending = FALSE;
+
+	/* Left over from the last server generation */
+	if ( info->type == GLAMO_DRI2_DONE ) {
+		glamoSwapInfoFree(info);
+		return;
+	}
+
+	r = dixLookupDrawable(&drawable, info->drawable_id, serverClient,
+	                      M_ANY, DixWriteAccess);
+	if ( r == Success && info->client ) {
+		DRI2SwapComplete(info->client, drawable, frame, tv_sec, tv_usec,
+		                 DRI2_FLIP_COMPLETE, info->event_func,
+		                 info->event_data);
+	}
+
+	glamoSwapInfoFree(info);
+}
+
+
+static int glamoScheduleSwap(ClientPtr client, DrawablePtr drawable,
+                             DRI2BufferPtr front_buffer,
+                             DRI2BufferPtr back_buffer,
+                             CARD64 *target_msc, CARD64 divisor,
+                             CARD64 remainder, DRI2SwapEventPtr func,
+                             void *data)
+{
+	ScreenPtr pScreen = drawable->pScreen;
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	struct glamo_dri2_swap_info *info;
+	CARD64 ust, current_msc, event_msc;
+
+	if ( !pScrn->vtSema || !glamoGetVblank(pScrn, &ust, &current_msc) ) {
+		goto blit;
+	}
+
+	/* Only one swap per drawable may wait for a vblank.  If the client
+	 * got ahead of itself, get the older one out of the way now. */
+	for ( info=pGlamo->dri2_swaps; info; info=info->next ) {
+		if ( info->type != GLAMO_DRI2_SWAP ) continue;
+		if ( info->drawable_id != drawable->id ) continue;
+		glamoExecuteSwap(drawable, info, FALSE, 0, 0, 0);
+		info->type = GLAMO_DRI2_DONE;
+	}
+
+	/* The swap interval is already folded into target_msc by DRI2 */
+	*target_msc = glamoTargetMSC(current_msc, *target_msc,
+	                             divisor, remainder);
+
+	info = glamoSwapInfoNew(client, drawable, GLAMO_DRI2_SWAP);
+	if ( !info ) goto blit;
+	info->front = front_buffer;
+	info->back = back_buffer;
+	info->event_func = func;
+	info->event_data = data;
+	info->target_msc = *target_msc;
+
+	/* A flip takes effect at the vblank after it is queued */
+	event_msc = *target_msc;
+	if ( glamoCanFlip(drawable, front_buffer, back_buffer) ) event_msc--;
+
+	if ( event_msc <= current_msc
+	  || !glamoQueueVblank(pScrn, event_msc, info) ) {
+		if ( !glamoExecuteSwap(drawable, info, TRUE, current_msc,
+		                       ust / 1000000, ust % 1000000) ) {
+			glamoSwapInfoFree(info);
+		}
+	}
+
+	return TRUE;
+
+blit:
+	*target_msc = 0;
+	glamoSwapBlit(drawable, front_buffer, back_buffer);
+	DRI2SwapComplete(client, drawable, 0, 0, 0, DRI2_BLIT_COMPLETE,
+	                 func, data);
+	return TRUE;
+}
+
+
+static int glamoGetMSC(DrawablePtr drawable, CARD64 *ust, CARD64 *msc)
+{
+	ScrnInfoPtr pScrn = xf86Screens[drawable->pScreen->myNum];
+
+	if ( !pScrn->vtSema ) {
+		*ust = 0;
+		*msc = 0;
+		return TRUE;
+	}
+
+	return glamoGetVblank(pScrn, ust, msc);
+}
+
+
+static int glamoScheduleWaitMSC(ClientPtr client, DrawablePtr drawable,
+                                CARD64 target_msc, CARD64 divisor,
+                                CARD64 remainder)
+{
+	ScrnInfoPtr pScrn = xf86Screens[drawable->pScreen->myNum];
+	struct glamo_dri2_swap_info *info;
+	CARD64 ust, current_msc;
+
+	if ( !pScrn->vtSema || !glamoGetVblank(pScrn, &ust, &current_msc) ) {
+		DRI2WaitMSCComplete(client, drawable, target_msc, 0, 0);
+		return TRUE;
+	}
+
+	if ( divisor == 0 && current_msc >= target_msc ) {
+		DRI2WaitMSCComplete(client, drawable, current_msc,
+		                    ust / 1000000, ust % 1000000);
+		return TRUE;
+	}
+
+	target_msc = glamoTargetMSC(current_msc, target_msc,
+	                            divisor, remainder);
+
+	info = glamoSwapInfoNew(client, drawable, GLAMO_DRI2_WAITMSC);
+	if ( !info ) {
+		DRI2WaitMSCComplete(client, drawable, current_msc,
+		                    ust / 1000000, ust % 1000000);
+		return TRUE;
+	}
+
+	if ( !glamoQueueVblank(pScrn, target_msc, info) ) {
+		glamoSwapInfoFree(info);
+		DRI2WaitMSCComplete(client, drawable, current_msc,
+		                    ust / 1000000, ust % 1000000);
+		return TRUE;
+	}
+
+	DRI2BlockClient(client, drawable);
+	return TRUE;
+}
+
+
+/* The kernel still has events to deliver for the requests outstanding when
+ * the screen closes, with pointers to them, so they can't just be freed.
+ * Wait a little for those events, with the requests cut off from their
+ * clients so the handlers only clean up.  Any which are further off are
+ * left on the list for the handlers of the next server generation, with
+ * the framebuffers of their flips already removed. */
+static void glamoSwapDrain(ScrnInfoPtr pScrn)
+{
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	struct glamo_dri2_swap_info *info;
+	drmEventContext context;
+	struct pollfd pfd;
+
+	for ( info=pGlamo->dri2_swaps; info; info=info->next ) {
+		if ( info->client ) {
+			FreeResourceByType(info->client_id,
+			                   glamo_dri2_swap_type, TRUE);
+			info->client = NULL;
+		}
+		if ( info->type != GLAMO_DRI2_FLIP ) {
+			info->type = GLAMO_DRI2_DONE;
+		}
+	}
+
+	memset(&context, 0, sizeof(context));
+	context.version = DRM_EVENT_CONTEXT_VERSION;
+	context.vblank_handler = glamoVblankHandler;
+	context.page_flip_handler = glamoFlipHandler;
+	pfd.fd = pGlamo->drm_fd;
+	pfd.events = POLLIN;
+	while ( pGlamo->dri2_swaps ) {
+		if ( poll(&pfd, 1, GLAMO_DRI2_DRAIN_TIMEOUT) <= 0 ) break;
+		drmHandleEvent(pGlamo->drm_fd, &context);
+	}
+
+	for ( info=pGlamo->dri2_swaps; info; info=info->next ) {
+		if ( info->type == GLAMO_DRI2_FLIP ) {
+			drmModeRmFB(pGlamo->drm_fd, info->old_fb_id);
+			info->old_fb_id = 0;
+			info->type = GLAMO_DRI2_DONE;
+		}
+	}
+}
+
+
+/* Dispatch vblank and page flip events from the DRM fd */
+static void glamoDRI2WakeupHandler(pointer data, int err, pointer read_mask)
+{
+	ScrnInfoPtr pScrn = data;
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	fd_set *read_fds = read_mask;
+	drmEventContext context;
+
+	if ( err < 0 || !FD_ISSET(pGlamo->drm_fd, read_fds) ) return;
+
+	memset(&context, 0, sizeof(context));
+	context.version = DRM_EVENT_CONTEXT_VERSION;
+	context.vblank_handler = glamoVblankHandler;
+	context.page_flip_handler = glamoFlipHandler;
+	drmHandleEvent(pGlamo->drm_fd, &context);
+}
+
+#endif
+
+
 void driScreenInit(ScreenPtr pScreen)
 {
 	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
@@ -311,6 +1184,9 @@ void driScreenInit(ScreenPtr pScreen)
 	dev_t d;
 	int i;
 
+	pGlamo->dri2_pool = NULL;
+	pGlamo->dri2_pool_timer = NULL;
+
 	fstat(pGlamo->drm_fd, &sbuf);
 	d = sbuf.st_rdev;
 	p = pGlamo->drm_devname;
@@ -326,7 +1202,9 @@ void driScreenInit(ScreenPtr pScreen)
 	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
 		   "[glamo-dri] Name of DRM device is '%s'\n", p);
 
-#if DRI2INFOREC_VERSION >= 3
+#if DRI2INFOREC_VERSION >= 4
+	dri2info.version = 4;
+#elif DRI2INFOREC_VERSION >= 3
 	dri2info.version = 3;
 #else
 	dri2info.version = 2;
@@ -343,6 +1221,22 @@ void driScreenInit(ScreenPtr pScreen)
 	dri2info.DestroyBuffers = glamoDestroyBuffers;
 #endif
 	dri2info.CopyRegion = glamoCopyRegion;
+#if DRI2INFOREC_VERSION >= 4
+	dri2info.ScheduleSwap = glamoScheduleSwap;
+	dri2info.GetMSC = glamoGetMSC;
+	dri2info.ScheduleWaitMSC = glamoScheduleWaitMSC;
+
+	pGlamo->dri2_flip_pending = FALSE;
+	if ( glamo_dri2_swap_generation != serverGeneration ) {
+		glamo_dri2_swap_type =
+		        CreateNewResourceType(glamoSwapInfoClientGone,
+		                              "GlamoDRI2SwapInfo");
+		glamo_dri2_swap_generation = serverGeneration;
+	}
+	AddGeneralSocket(pGlamo->drm_fd);
+	RegisterBlockAndWakeupHandlers((BlockHandlerProcPtr)NoopDDA,
+	                               glamoDRI2WakeupHandler, pScrn);
+#endif
 
 	if ( !DRI2ScreenInit(pScreen, &dri2info) ) {
 		xf86DrvMsg(pScrn->scrnIndex, X_INFO,
@@ -356,5 +1250,17 @@ void driScreenInit(ScreenPtr pScreen)
 
 void driCloseScreen(ScreenPtr pScreen)
 {
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+
+#if DRI2INFOREC_VERSION >= 4
+	RemoveBlockAndWakeupHandlers((BlockHandlerProcPtr)NoopDDA,
+	                             glamoDRI2WakeupHandler, pScrn);
+	RemoveGeneralSocket(pGlamo->drm_fd);
+	glamoSwapDrain(pScrn);
+#endif
 	DRI2CloseScreen(pScreen);
+	TimerFree(pGlamo->dri2_pool_timer);
+	pGlamo->dri2_pool_timer = NULL;
+	glamoPoolExpire(pScreen, TRUE);
 }
@@ -24,3 +24,4 @@
 
 extern void driScreenInit(ScreenPtr pScreen);
 extern void driCloseScreen(ScreenPtr pScreen);
+extern Bool driPoolRelease(ScreenPtr pScreen);
@@ -34,6 +34,9 @@
 
 #include "glamo.h"
 #include "glamo-regs.h"
+#include "glamo-cmdq.h"
+#include "glamo-sim.h"
+#include "glamo-capture.h"
 #include "glamo-kms-driver.h"
 
 #include <fcntl.h>
@@ -76,6 +79,9 @@ GlamoCloseScreen(int scrnIndex, ScreenPtr pScreen);
 static Bool
 GlamoCrtcResize(ScrnInfoPtr scrn, int width, int height);
 
+static Bool
+GlamoCreateScreenResources(ScreenPtr pScreen);
+
 static Bool
 GlamoInitFramebufferDevice(ScrnInfoPtr scrn, const char *fb_device);
 
@@ -129,6 +135,11 @@ typedef enum {
 	OPTION_SHADOW_FB,
     OPTION_DEVICE,
 	OPTION_DEBUG,
+	OPTION_SIMULATE,
+	OPTION_CAPTURE_FILE,
+	OPTION_RING_SIZE,
+	OPTION_BATCH_SIZE,
+	OPTION_PEEPHOLE,
 #ifdef JBT6K74_SET_STATE
     OPTION_JBT6K74_STATE_PATH
 #endif
@@ -137,6 +148,11 @@ typedef enum {
 static const OptionInfoRec GlamoOptions[] = {
 	{ OPTION_SHADOW_FB,	"ShadowFB",	OPTV_BOOLEAN,	{0},	FALSE },
 	{ OPTION_DEBUG,		"debug",	OPTV_BOOLEAN,	{0},	FALSE },
+	{ OPTION_SIMULATE,	"Simulate",	OPTV_BOOLEAN,	{0},	FALSE },
+	{ OPTION_CAPTURE_FILE,	"CaptureFile",	OPTV_STRING,	{0},	FALSE },
+	{ OPTION_RING_SIZE,	"RingSize",	OPTV_INTEGER,	{0},	FALSE },
+	{ OPTION_BATCH_SIZE,	"BatchSize",	OPTV_INTEGER,	{0},	FALSE },
+	{ OPTION_PEEPHOLE,	"Peephole",	OPTV_BOOLEAN,	{0},	FALSE },
 #ifdef JBT6K74_SET_STATE
 	{ OPTION_JBT6K74_STATE_PATH, "StatePath", OPTV_STRING, {0}, FALSE },
 #endif
@@ -187,6 +203,7 @@ GlamoGetRec(ScrnInfoPtr pScrn)
 		return TRUE;
 
 	pScrn->driverPrivate = xnfcalloc(sizeof(GlamoRec), 1);
+	GlamoPTR(pScrn)->capture_fd = -1;
 	return TRUE;
 }
 
@@ -201,6 +218,65 @@ GlamoFreeRec(ScrnInfoPtr pScrn)
 
 /* -------------------------------------------------------------------- */
 
+/* Video memory taken by a screen of the given size.  A rotated screen
+ * swaps width and height, which doesn't change this. */
+static size_t
+GlamoFrontSize(ScrnInfoPtr pScrn, int width, int height)
+{
+    return (size_t)width * height * (pScrn->bitsPerPixel / 8);
+}
+
+static void
+GlamoSetRingSize(ScrnInfoPtr pScrn)
+{
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+    int kib;
+
+    pGlamo->ring_len = GLAMO_CMDQ_DEFAULT_SIZE;
+
+    if (!xf86GetOptValInteger(pGlamo->Options, OPTION_RING_SIZE, &kib))
+        return;
+
+    if (kib * 1024 < GLAMO_CMDQ_MIN_SIZE || kib * 1024 > GLAMO_CMDQ_MAX_SIZE
+        || (kib & (kib - 1))) {
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "RingSize must be a power of two from %d to %d KiB, "
+                   "using %d\n", GLAMO_CMDQ_MIN_SIZE / 1024,
+                   GLAMO_CMDQ_MAX_SIZE / 1024, GLAMO_CMDQ_DEFAULT_SIZE / 1024);
+        return;
+    }
+
+    pGlamo->ring_len = kib * 1024;
+    xf86DrvMsg(pScrn->scrnIndex, X_CONFIG,
+               "Command queue size: %d KiB\n", kib);
+}
+
+/* How many commands may be held back while the engine is busy (see
+ * GLAMOFlushCMDQ()); they are kept in a buffer the size of the ring */
+static void
+GlamoSetBatchSize(ScrnInfoPtr pScrn)
+{
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+    int kib;
+
+    pGlamo->batch_size = min(GLAMO_CMDQ_DEFAULT_BATCH, pGlamo->ring_len);
+
+    if (!xf86GetOptValInteger(pGlamo->Options, OPTION_BATCH_SIZE, &kib))
+        return;
+
+    if (kib < 0 || kib * 1024 > pGlamo->ring_len) {
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "BatchSize must be from 0 to the RingSize of %d KiB, "
+                   "using %d\n", (int)(pGlamo->ring_len / 1024),
+                   (int)(pGlamo->batch_size / 1024));
+        return;
+    }
+
+    pGlamo->batch_size = kib * 1024;
+    xf86DrvMsg(pScrn->scrnIndex, X_CONFIG,
+               "Command batch size: %d KiB\n", kib);
+}
+
 /* Map the mmio registers of the glamo. We can not use xf86MapVidMem since it
  * will open /dev/mem without O_SYNC. */
 static Bool
@@ -497,6 +573,13 @@ GlamoPreInit(ScrnInfoPtr pScrn, int flags)
 
     debug = xf86ReturnOptValBool(pGlamo->Options, OPTION_DEBUG, FALSE);
 
+    pGlamo->sim = xf86ReturnOptValBool(pGlamo->Options, OPTION_SIMULATE, FALSE);
+    pGlamo->peephole = xf86ReturnOptValBool(pGlamo->Options, OPTION_PEEPHOLE,
+                                            FALSE);
+
+    GlamoSetRingSize(pScrn);
+    GlamoSetBatchSize(pScrn);
+
 #ifdef JBT6K74_SET_STATE
     pGlamo->jbt6k74_state_path = xf86GetOptValString(pGlamo->Options,
                                                      OPTION_JBT6K74_STATE_PATH);
@@ -517,11 +600,131 @@ GlamoPreInit(ScrnInfoPtr pScrn, int flags)
         return FALSE;
     }
 
+    if (pGlamo->shadowFB && xf86LoadSubModule(pScrn, "shadow") == NULL) {
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "Couldn't load the shadow module, drawing to video "
+                   "memory directly\n");
+        pGlamo->shadowFB = FALSE;
+    }
+
     TRACE_EXIT("PreInit");
     return TRUE;
 }
 
 
+/* Where a row of the shadow framebuffer goes in video memory.  Both have
+ * the pitch of the screen pixmap, which follows rotation. */
+static void *
+GlamoShadowWindow(ScreenPtr pScreen, CARD32 row, CARD32 offset, int mode,
+                  CARD32 *size, void *closure)
+{
+    GlamoPtr pGlamo = GlamoPTR(xf86Screens[pScreen->myNum]);
+    CARD32 pitch = pScreen->GetScreenPixmap(pScreen)->devKind;
+
+    *size = pitch;
+    return pGlamo->fbstart + row * pitch + offset;
+}
+
+/* Copy what was drawn since the last update to video memory, just before
+ * the server sleeps */
+static void
+GlamoShadowUpdate(ScreenPtr pScreen, shadowBufPtr pBuf)
+{
+    /* The screen is redrawn when we get the VT back */
+    if (!xf86Screens[pScreen->myNum]->vtSema)
+        return;
+
+    shadowUpdatePacked(pScreen, pBuf);
+}
+
+/* Make the shadow framebuffer hold a screen of the given size, keeping the
+ * screen pixmap pointing at it even while framebuffer access is off */
+static Bool
+GlamoShadowResize(ScrnInfoPtr pScrn, size_t size)
+{
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+    PixmapPtr pPixmap;
+    void *shadow;
+
+    if (size <= pGlamo->shadow_size)
+        return TRUE;
+
+    shadow = calloc(1, size);
+    if (!shadow) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                   "No memory for a %zu KiB shadow framebuffer\n",
+                   size / 1024);
+        return FALSE;
+    }
+
+    if (pGlamo->shadow) {
+        pPixmap = pGlamo->pScreen->GetScreenPixmap(pGlamo->pScreen);
+        if (pPixmap && pPixmap->devPrivate.ptr == pGlamo->shadow)
+            pPixmap->devPrivate.ptr = shadow;
+        if (pScrn->pixmapPrivate.ptr == pGlamo->shadow)
+            pScrn->pixmapPrivate.ptr = shadow;
+        free(pGlamo->shadow);
+    }
+
+    pGlamo->shadow = shadow;
+    pGlamo->shadow_size = size;
+
+    return TRUE;
+}
+
+/* Render the screen into system memory, which unlike video memory is
+ * cached, and copy the damaged parts to video memory from the block
+ * handler.  Only used without acceleration, as the engine can't draw to
+ * the shadow. */
+static Bool
+GlamoShadowInit(ScrnInfoPtr pScrn)
+{
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+    ScreenPtr pScreen = pGlamo->pScreen;
+
+    if (!GlamoShadowResize(pScrn, GlamoFrontSize(pScrn, pScrn->displayWidth,
+                                                 pScrn->virtualY)))
+        return FALSE;
+
+    if (!shadowSetup(pScreen)) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                   "Shadow framebuffer initialization failed\n");
+        free(pGlamo->shadow);
+        pGlamo->shadow = NULL;
+        pGlamo->shadow_size = 0;
+        return FALSE;
+    }
+
+    pGlamo->CreateScreenResources = pScreen->CreateScreenResources;
+    pScreen->CreateScreenResources = GlamoCreateScreenResources;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Using a shadow framebuffer\n");
+
+    return TRUE;
+}
+
+static Bool
+GlamoCreateScreenResources(ScreenPtr pScreen)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+    PixmapPtr pPixmap;
+    Bool ret;
+
+    pScreen->CreateScreenResources = pGlamo->CreateScreenResources;
+    ret = pScreen->CreateScreenResources(pScreen);
+    pScreen->CreateScreenResources = GlamoCreateScreenResources;
+    if (!ret)
+        return FALSE;
+
+    /* The screen pixmap was set up on video memory by fbScreenInit() */
+    pPixmap = pScreen->GetScreenPixmap(pScreen);
+    pScreen->ModifyPixmapHeader(pPixmap, -1, -1, -1, -1, -1, pGlamo->shadow);
+
+    return shadowAdd(pScreen, pPixmap, GlamoShadowUpdate,
+                     GlamoShadowWindow, 0, NULL);
+}
+
 static Bool
 GlamoScreenInit(int scrnIndex, ScreenPtr pScreen, int argc, char **argv)
 {
@@ -529,8 +732,7 @@ GlamoScreenInit(int scrnIndex, ScreenPtr pScreen, int argc, char **argv)
     GlamoPtr pGlamo = GlamoPTR(pScrn);
     VisualPtr visual;
     int ret, flags;
-    size_t mem_start = 640 * 480 * 2;
-    size_t mem_size = 1024 * 1024 * 4 - mem_start;
+    size_t mem_start, mem_size;
 
     TRACE_ENTER("GlamoScreenInit");
 
@@ -571,6 +773,12 @@ GlamoScreenInit(int scrnIndex, ScreenPtr pScreen, int argc, char **argv)
 
     pGlamo->fbstart = pGlamo->fbmem + pGlamo->fboff;
 
+    /* The screen sits at the start of video memory, and acceleration gets
+     * the rest */
+    mem_start = GlamoFrontSize(pScrn, pScrn->displayWidth, pScrn->virtualY);
+    mem_size = pGlamo->fb_fix.smem_len - pGlamo->fboff;
+    mem_size = mem_size > mem_start ? mem_size - mem_start : 0;
+
     ret = fbScreenInit(pScreen, pGlamo->fbstart, pScrn->virtualX,
                        pScrn->virtualY, pScrn->xDpi, pScrn->yDpi,
                        pScrn->displayWidth,  pScrn->bitsPerPixel);
@@ -596,12 +804,18 @@ GlamoScreenInit(int scrnIndex, ScreenPtr pScreen, int argc, char **argv)
                    "Render extension initialisation failed\n");
 
     pGlamo->pScreen = pScreen;
+    GlamoStatsInit(pScrn);
 
-    /* map in the registers */
-    if (GlamoMapMMIO(pScrn)) {
+    /* map in the registers, or fake them */
+    if (pGlamo->sim ? GLAMOSimInit(pScrn) : GlamoMapMMIO(pScrn)) {
 
         xf86LoadSubModule(pScrn, "exa");
 
+        GlamoCaptureOpen(pScrn,
+                         xf86GetOptValString(pGlamo->Options,
+                                             OPTION_CAPTURE_FILE),
+                         GLAMO_CAPTURE_SOURCE_RING);
+
     	if (!GLAMODrawInit(pScrn, mem_start, mem_size)) {
             xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
                        "EXA hardware acceleration initialization failed\n");
@@ -610,6 +824,10 @@ GlamoScreenInit(int scrnIndex, ScreenPtr pScreen, int argc, char **argv)
         }
     }
 
+    /* The engine draws to the screen in video memory */
+    if (pGlamo->shadowFB)
+        pGlamo->shadowFB = !pGlamo->accel && GlamoShadowInit(pScrn);
+
     xf86SetBlackWhitePixels(pScreen);
     miInitializeBackingStore(pScreen);
     xf86SetBackingStore(pScreen);
@@ -659,12 +877,25 @@ GlamoCloseScreen(int scrnIndex, ScreenPtr pScreen)
 
     if (pGlamo->accel)
         GLAMODrawFini(pScrn);
+    GlamoCaptureClose(pGlamo);
+
+    if (pGlamo->shadow) {
+        shadowRemove(pScreen, pScreen->GetScreenPixmap(pScreen));
+        free(pGlamo->shadow);
+        pGlamo->shadow = NULL;
+        pGlamo->shadow_size = 0;
+    }
+
+    GlamoStatsFini(pScrn);
 
     if (pScrn->vtSema)
         GlamoRestoreHW(pScrn);
 
+    if (pGlamo->sim)
+        GLAMOSimFini(pScrn);
+    else
+        GlamoUnmapMMIO(pScrn);
     fbdevHWUnmapVidmem(pScrn);
-    GlamoUnmapMMIO(pScrn);
 
     if (pGlamo->colormap) {
         free(pGlamo->colormap);
@@ -673,13 +904,23 @@ GlamoCloseScreen(int scrnIndex, ScreenPtr pScreen)
 
     pScrn->vtSema = FALSE;
 
-    pScreen->CreateScreenResources = pGlamo->CreateScreenResources;
+    if (pGlamo->CreateScreenResources)
+        pScreen->CreateScreenResources = pGlamo->CreateScreenResources;
     pScreen->CloseScreen = pGlamo->CloseScreen;
     return (*pScreen->CloseScreen)(scrnIndex, pScreen);
 }
 
 static Bool
 GlamoCrtcResize(ScrnInfoPtr pScrn, int width, int height) {
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+
+    if (pGlamo->accel &&
+        !GLAMODrawResize(pScrn, GlamoFrontSize(pScrn, width, height)))
+        return FALSE;
+    if (pGlamo->shadow &&
+        !GlamoShadowResize(pScrn, GlamoFrontSize(pScrn, width, height)))
+        return FALSE;
+
     pScrn->virtualX = width;
     pScrn->virtualY = height;
     pScrn->displayWidth = width * (pScrn->bitsPerPixel / 8);
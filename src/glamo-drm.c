@@ -31,24 +31,249 @@
 #include <glamo_bo.h>
 
 #include "glamo.h"
+#include "glamo-drm.h"
+#include "glamo-capture.h"
+#include "glamo-peephole.h"
+#include "glamo-submit.h"
+#include "glamo-timing.h"
 
 /* How many commands can be stored before forced dispatch */
 #define GLAMO_CMDQ_MAX_COUNT 1024
 
+/*
+ * Each submission gets the next sequence number as its fence.  The kernel
+ * runs submissions in order and waits for a buffer object by waiting for
+ * the last submission using it, so waiting for any buffer object which a
+ * submission used waits for that submission.  The fence keeps a reference
+ * to the last one, so it outlives its pixmap.
+ */
+static void GlamoDRMFenceEmit(GlamoPtr pGlamo)
+{
+	struct glamo_fence *fence;
+
+	pGlamo->fence_seq++;
+	fence = &pGlamo->fences[pGlamo->fence_seq % GLAMO_NUM_FENCES];
+
+	/* The fence reusing a slot comes later, so it stands in for the one
+	 * it replaces */
+	if ( fence->bo ) glamo_bo_unref(fence->bo);
+
+	fence->seq = pGlamo->fence_seq;
+	fence->bo = pGlamo->last_buffer_object;
+	if ( fence->bo ) glamo_bo_ref(fence->bo);
+
+	pGlamo->last_buffer_object = NULL;
+}
+
+
+/* Drop the references held by the fences up to seq */
+static void GlamoDRMFenceRetire(GlamoPtr pGlamo, unsigned int seq)
+{
+	struct glamo_fence *fence;
+	int i;
+
+	for ( i=0; i<GLAMO_NUM_FENCES; i++ ) {
+		fence = &pGlamo->fences[i];
+		if ( fence->bo && !GLAMO_SEQ_AFTER(fence->seq, seq) ) {
+			glamo_bo_unref(fence->bo);
+			fence->bo = NULL;
+		}
+	}
+
+	if ( GLAMO_SEQ_AFTER(seq, pGlamo->fence_retired) )
+		pGlamo->fence_retired = seq;
+}
+
+
+/* Note that a buffer object is idle, so the submissions which used it, and
+ * all before them, are done.  This drops the fences' references to it. */
+void GlamoDRMFenceIdle(GlamoPtr pGlamo, struct glamo_bo *bo)
+{
+	unsigned int done = pGlamo->fence_retired;
+	int i;
+
+	for ( i=0; i<GLAMO_NUM_FENCES; i++ ) {
+		if ( pGlamo->fences[i].bo == bo
+		     && GLAMO_SEQ_AFTER(pGlamo->fences[i].seq, done) )
+			done = pGlamo->fences[i].seq;
+	}
+
+	GlamoDRMFenceRetire(pGlamo, done);
+}
+
+
+/* Wait for the submission with sequence number seq to finish.
+ * Returns FALSE if it was already known to be done. */
+Bool GlamoDRMFenceWait(GlamoPtr pGlamo, unsigned int seq)
+{
+	struct glamo_fence *fence;
+
+	if ( !GLAMO_SEQ_AFTER(seq, pGlamo->fence_retired) ) return FALSE;
+	if ( GLAMO_SEQ_AFTER(seq, pGlamo->fence_seq) ) seq = pGlamo->fence_seq;
+
+	/* The kernel can only wait for what it has been given */
+	if ( pGlamo->submit_queue ) GlamoSubmitWait(pGlamo->submit_queue, seq);
+
+	/* If the slot has been reused, wait for the later submission */
+	fence = &pGlamo->fences[seq % GLAMO_NUM_FENCES];
+
+	if ( fence->bo ) {
+		glamo_bo_wait(fence->bo);
+	} else {
+
+		struct drm_glamo_gem_wait_rendering args;
+
+		/* A submission without buffer objects: wait for everything */
+		args.handle = 0;
+		args.have_handle = 0;
+		drmCommandWriteRead(pGlamo->drm_fd,
+				    DRM_GLAMO_GEM_WAIT_RENDERING,
+				    &args, sizeof(args));
+	}
+
+	GlamoDRMFenceRetire(pGlamo, fence->seq);
+
+	return TRUE;
+}
+
+
+/* Whether the submission with sequence number seq, which used bo, may
+ * still be running.  The kernel is only asked about bo once it has been
+ * given that submission, so this never waits for the submission thread. */
+Bool GlamoDRMFenceBusy(GlamoPtr pGlamo, unsigned int seq,
+                       struct glamo_bo *bo)
+{
+	uint32_t domain;
+
+	if ( !GLAMO_SEQ_AFTER(seq, pGlamo->fence_retired) ) return FALSE;
+	if ( pGlamo->submit_queue
+	     && GLAMO_SEQ_AFTER(seq, pGlamo->submit_queue->submitted) )
+		return TRUE;
+	if ( glamo_bo_is_busy(bo, &domain) ) return TRUE;
+
+	GlamoDRMFenceIdle(pGlamo, bo);
+	return FALSE;
+}
+
+
+/* Hand a command buffer to the kernel.  This runs on the submission
+ * thread, if there is one. */
+static int GlamoDRMSubmit(void *data, struct glamo_submission *sub)
+{
+	GlamoPtr pGlamo = data;
+	drm_glamo_cmd_buffer_t cmdbuf;
+
+	cmdbuf.buf = (char *)sub->cmds;
+	cmdbuf.bufsz = sub->cmd_bytes;
+	cmdbuf.nobjs = sub->nobjs;
+	cmdbuf.objs = sub->objs;
+	cmdbuf.obj_pos = sub->obj_pos;
+
+	return drmCommandWrite(pGlamo->drm_fd, DRM_GLAMO_CMDBUF,
+	                       &cmdbuf, sizeof(cmdbuf));
+}
+
+
+/* Point the command sequence being prepared at the submission thread's
+ * current slot */
+static void GlamoDRMUseSlot(GlamoPtr pGlamo)
+{
+	struct glamo_submission *sub = GlamoSubmitCurrent(pGlamo->submit_queue);
+
+	pGlamo->cmdq_drm = sub->cmds;
+	pGlamo->cmdq_objs = sub->objs;
+	pGlamo->cmdq_obj_pos = sub->obj_pos;
+	pGlamo->cmdq_bos = sub->bos;
+}
+
+
+/* Run the peephole pass over the prepared command sequence, and put the
+ * relocations it kept, and their references, in their new order */
+static void GlamoDRMPeephole(GlamoPtr pGlamo)
+{
+	static uint32_t handles[GLAMO_CMDQ_MAX_COUNT];
+	static struct glamo_bo *bos[GLAMO_CMDQ_MAX_COUNT];
+	static int map[GLAMO_CMDQ_MAX_COUNT];
+	int nrelocs = pGlamo->cmdq_obj_used;
+	int used, i;
+
+	memcpy(handles, pGlamo->cmdq_objs, nrelocs * sizeof(uint32_t));
+	used = GlamoPeepholeRun(pGlamo, pGlamo->cmdq_drm,
+	                        pGlamo->cmdq_drm_used, handles,
+	                        pGlamo->cmdq_obj_pos, &nrelocs, map);
+	if ( used == pGlamo->cmdq_drm_used ) return;
+
+	for ( i=0; i<nrelocs; i++ )
+		pGlamo->cmdq_objs[i] = handles[map[i]];
+
+	/* A relocation may have been dropped, or be needed twice */
+	if ( pGlamo->cmdq_bos ) {
+		memcpy(bos, pGlamo->cmdq_bos,
+		       pGlamo->cmdq_obj_used * sizeof(struct glamo_bo *));
+		for ( i=0; i<nrelocs; i++ ) {
+			pGlamo->cmdq_bos[i] = bos[map[i]];
+			glamo_bo_ref(pGlamo->cmdq_bos[i]);
+		}
+		for ( i=0; i<pGlamo->cmdq_obj_used; i++ )
+			glamo_bo_unref(bos[i]);
+	}
+
+	pGlamo->cmdq_obj_used = nrelocs;
+	pGlamo->cmdq_drm_used = used;
+}
+
+
 /* Submit the prepared command sequence to the kernel */
 void GlamoDRMDispatch(GlamoPtr pGlamo)
 {
-	drm_glamo_cmd_buffer_t cmdbuf;
+	struct glamo_submission sub;
+	struct glamo_submission *queued;
 	int r;
+	GLAMO_TIMING_LOCAL(start);
+
+	GLAMO_TIMING_BEGIN(start);
 
-	cmdbuf.buf = (char *)pGlamo->cmdq_drm;
-	cmdbuf.bufsz = pGlamo->cmdq_drm_used * 2;	/* -> bytes */
-	cmdbuf.nobjs = pGlamo->cmdq_obj_used;
-	cmdbuf.objs = pGlamo->cmdq_objs;
-	cmdbuf.obj_pos = pGlamo->cmdq_obj_pos;
+	if ( pGlamo->peephole )
+		GlamoDRMPeephole(pGlamo);
+
+	sub.cmds = pGlamo->cmdq_drm;
+	sub.cmd_bytes = pGlamo->cmdq_drm_used * 2;	/* -> bytes */
+	sub.nobjs = pGlamo->cmdq_obj_used;
+	sub.objs = pGlamo->cmdq_objs;
+	sub.obj_pos = pGlamo->cmdq_obj_pos;
+
+	pGlamo->stats.submissions++;
+	pGlamo->stats.bytes_submitted += sub.cmd_bytes;
+
+	if ( pGlamo->capture_fd != -1 ) {
+		GlamoCaptureWrite(pGlamo, pGlamo->cmdq_drm, sub.cmd_bytes,
+		                  pGlamo->cmdq_objs,
+		                  (uint32_t *)pGlamo->cmdq_obj_pos,
+		                  pGlamo->cmdq_obj_used);
+	}
+
+	if ( pGlamo->submit_queue ) {
+
+		/* The slot already holds the commands */
+		GlamoDRMFenceEmit(pGlamo);
+		queued = GlamoSubmitCurrent(pGlamo->submit_queue);
+		queued->cmd_bytes = sub.cmd_bytes;
+		queued->nobjs = sub.nobjs;
+		queued->seq = pGlamo->fence_seq;
+		if ( !GlamoSubmitQueue(pGlamo->submit_queue) )
+			pGlamo->stats.ring_full_waits++;
+		GlamoDRMUseSlot(pGlamo);
+
+		r = pGlamo->submit_queue->errors != pGlamo->submit_errors;
+		pGlamo->submit_errors = pGlamo->submit_queue->errors;
+
+	} else {
+
+		r = GlamoDRMSubmit(pGlamo, &sub);
+		GlamoDRMFenceEmit(pGlamo);
+
+	}
 
-	r = drmCommandWrite(pGlamo->drm_fd, DRM_GLAMO_CMDBUF,
-	                    &cmdbuf, sizeof(cmdbuf));
 	if ( r != 0 ) {
 		xf86DrvMsg(pGlamo->pScreen->myNum, X_ERROR,
 		           "DRM_GLAMO_CMDBUF failed\n");
@@ -57,6 +282,37 @@ void GlamoDRMDispatch(GlamoPtr pGlamo)
 	/* Reset counts to zero for the next sequence */
 	pGlamo->cmdq_obj_used = 0;
 	pGlamo->cmdq_drm_used = 0;
+
+	GLAMO_TIMING_END(start, GLAMO_PHASE_DISPATCH);
+}
+
+
+/* Wait for the submission thread to hand everything dispatched so far to
+ * the kernel, before letting clients at the buffers they share with the
+ * server.  Everything else goes by fences, and never waits for the
+ * thread unless it waits for the engine too. */
+void GlamoDRMDrain(GlamoPtr pGlamo)
+{
+	if ( pGlamo->submit_queue )
+		GlamoSubmitWait(pGlamo->submit_queue, pGlamo->fence_seq);
+}
+
+
+/* Clients are told about rendering once the server goes to sleep, and may
+ * then submit their own to the buffers they share with the server, so
+ * what was drawn to those must have reached the kernel.  The rest is left
+ * to the thread. */
+static void GlamoDRMBlockHandler(pointer data, OSTimePtr timeout,
+                                 pointer read_mask)
+{
+	GlamoPtr pGlamo = data;
+
+	GlamoSubmitWait(pGlamo->submit_queue, pGlamo->exported_seq);
+}
+
+
+static void GlamoDRMWakeupHandler(pointer data, int err, pointer read_mask)
+{
 }
 
 
@@ -85,6 +341,10 @@ void GlamoDRMAddCommandBO(GlamoPtr pGlamo, uint16_t reg, struct glamo_bo *bo)
 
 	/* Record object position */
 	pGlamo->cmdq_objs[pGlamo->cmdq_obj_used] = bo->handle;
+	if ( pGlamo->cmdq_bos ) {
+		glamo_bo_ref(bo);
+		pGlamo->cmdq_bos[pGlamo->cmdq_obj_used] = bo;
+	}
 	/* -> bytes */
 	pGlamo->cmdq_obj_pos[pGlamo->cmdq_obj_used] = pGlamo->cmdq_drm_used * 2;
 	pGlamo->cmdq_obj_used++;
@@ -99,15 +359,74 @@ void GlamoDRMAddCommandBO(GlamoPtr pGlamo, uint16_t reg, struct glamo_bo *bo)
 }
 
 
-void GlamoDRMInit(GlamoPtr pGlamo)
+void GlamoDRMInit(GlamoPtr pGlamo, Bool threaded)
 {
-	pGlamo->cmdq_objs = malloc(GLAMO_CMDQ_MAX_COUNT*sizeof(uint32_t));
-	pGlamo->cmdq_obj_pos = malloc(GLAMO_CMDQ_MAX_COUNT*sizeof(unsigned int));
 	pGlamo->cmdq_obj_used = 0;
 	pGlamo->cmdq_drm_used = 0;
 	/* we're using 2bytes per entry (uint16_t) that's why we need to allocate
 	 * GLAMO_CMDQ_MAX_COUNT * 2 bytes
 	 */
 	pGlamo->cmdq_drm_size = 2 * GLAMO_CMDQ_MAX_COUNT;
-	pGlamo->cmdq_drm = malloc(pGlamo->cmdq_drm_size);
+	pGlamo->cmdq_bos = NULL;
+	pGlamo->submit_queue = NULL;
+	pGlamo->submit_errors = 0;
+
+	if ( threaded ) {
+		pGlamo->submit_queue = GlamoSubmitCreate(GlamoDRMSubmit, pGlamo,
+		                                         pGlamo->cmdq_drm_size,
+		                                         GLAMO_CMDQ_MAX_COUNT);
+		if ( pGlamo->submit_queue ) {
+			xf86DrvMsg(pGlamo->pScreen->myNum, X_INFO,
+			           "Submitting commands from a thread\n");
+			GlamoDRMUseSlot(pGlamo);
+			RegisterBlockAndWakeupHandlers(GlamoDRMBlockHandler,
+			                               GlamoDRMWakeupHandler,
+			                               pGlamo);
+		} else {
+			xf86DrvMsg(pGlamo->pScreen->myNum, X_WARNING,
+			           "Couldn't start the submission thread\n");
+		}
+	}
+
+	if ( !pGlamo->submit_queue ) {
+		pGlamo->cmdq_objs = malloc(GLAMO_CMDQ_MAX_COUNT
+		                           * sizeof(uint32_t));
+		pGlamo->cmdq_obj_pos = malloc(GLAMO_CMDQ_MAX_COUNT
+		                              * sizeof(unsigned int));
+		pGlamo->cmdq_drm = malloc(pGlamo->cmdq_drm_size);
+	}
+
+	pGlamo->last_buffer_object = NULL;
+	memset(pGlamo->fences, 0, sizeof(pGlamo->fences));
+	pGlamo->fence_seq = 0;
+	pGlamo->fence_retired = 0;
+	pGlamo->exported_seq = 0;
+}
+
+
+void GlamoDRMFini(GlamoPtr pGlamo)
+{
+	int i;
+
+	if ( pGlamo->submit_queue ) {
+		/* Commands which were never dispatched */
+		for ( i=0; i<pGlamo->cmdq_obj_used; i++ )
+			glamo_bo_unref(pGlamo->cmdq_bos[i]);
+		RemoveBlockAndWakeupHandlers(GlamoDRMBlockHandler,
+		                             GlamoDRMWakeupHandler, pGlamo);
+		GlamoSubmitDestroy(pGlamo->submit_queue);
+		pGlamo->submit_queue = NULL;
+		pGlamo->cmdq_bos = NULL;
+	} else {
+		free(pGlamo->cmdq_objs);
+		free(pGlamo->cmdq_obj_pos);
+		free(pGlamo->cmdq_drm);
+	}
+
+	GlamoDRMFenceRetire(pGlamo, pGlamo->fence_seq);
+	GlamoPeepholeFini();
+
+	pGlamo->cmdq_objs = NULL;
+	pGlamo->cmdq_obj_pos = NULL;
+	pGlamo->cmdq_drm = NULL;
 }
@@ -29,8 +29,17 @@
 
 #include "glamo.h"
 
-extern void GlamoDRMInit(GlamoPtr pGlamo);
+/* Whether fence sequence number a comes after b, allowing for wrapping */
+#define GLAMO_SEQ_AFTER(a, b) ((int)((a) - (b)) > 0)
+
+extern void GlamoDRMInit(GlamoPtr pGlamo, Bool threaded);
+extern void GlamoDRMFini(GlamoPtr pGlamo);
 extern void GlamoDRMDispatch(GlamoPtr pGlamo);
+extern void GlamoDRMDrain(GlamoPtr pGlamo);
+extern Bool GlamoDRMFenceWait(GlamoPtr pGlamo, unsigned int seq);
+extern void GlamoDRMFenceIdle(GlamoPtr pGlamo, struct glamo_bo *bo);
+extern Bool GlamoDRMFenceBusy(GlamoPtr pGlamo, unsigned int seq,
+                              struct glamo_bo *bo);
 extern void GlamoDRMAddCommand(GlamoPtr pGlamo, uint16_t reg, uint16_t val);
 extern void GlamoDRMAddCommandBO(GlamoPtr pGlamo, uint16_t reg,
                                  struct glamo_bo *bo);
@@ -25,6 +25,8 @@
 #include "glamo.h"
 #include "glamo-engine.h"
 #include "glamo-regs.h"
+#include "glamo-sim.h"
+#include "glamo-timing.h"
 
 #ifdef HAVE_ENGINE_IOCTLS
 #   include <linux/types.h>
@@ -36,6 +38,8 @@ void
 GLAMOEngineReset(GlamoPtr pGlamo, enum GLAMOEngine engine)
 {
 #ifdef HAVE_ENGINE_IOCTLS
+    if (pGlamo->sim)
+        return;
     if (ioctl(pGlamo->fb_fd, GLAMOFB_ENGINE_RESET, (void*)((__u32)engine)) == -1)
         xf86DrvMsg(xf86Screens[pGlamo->pScreen->myNum]->scrnIndex, X_ERROR,
                   "Framebuffer ioctl GLAMOFB_ENGINE_RESET failed: %s\n",
@@ -76,6 +80,8 @@ void
 GLAMOEngineDisable(GlamoPtr pGlamo, enum GLAMOEngine engine)
 {
 #ifdef HAVE_ENGINE_IOCTLS
+    if (pGlamo->sim)
+        return;
     if (ioctl(pGlamo->fb_fd, GLAMOFB_ENGINE_DISABLE, (void*)((__u32)engine)) == -1)
         xf86DrvMsg(xf86Screens[pGlamo->pScreen->myNum]->scrnIndex, X_ERROR,
                   "Framebuffer ioctl GLAMOFB_ENGINE_DISABLE failed: %s\n",
@@ -134,6 +140,8 @@ void
 GLAMOEngineEnable(GlamoPtr pGlamo, enum GLAMOEngine engine)
 {
 #ifdef HAVE_ENGINE_IOCTLS
+    if (pGlamo->sim)
+        return;
     if (ioctl(pGlamo->fb_fd, GLAMOFB_ENGINE_ENABLE, (void*)((__u32)engine)) == -1)
         xf86DrvMsg(xf86Screens[pGlamo->pScreen->myNum]->scrnIndex, X_ERROR,
                   "Framebuffer ioctl GLAMOFB_ENGINE_ENABLE failed: %s\n",
@@ -221,6 +229,8 @@ GLAMOEngineBusy(GlamoPtr pGlamo, enum GLAMOEngine engine)
 			break;
 	}
 
+	if (pGlamo->sim)
+		GLAMOSimPoll(pGlamo);
 	status = MMIO_IN16(mmio, GLAMO_REG_CMDQ_STATUS);
 
 	return !((status & mask) == val);
@@ -232,6 +242,8 @@ GLAMOEngineWait(GlamoPtr pGlamo,
 {
 	volatile char *mmio = pGlamo->reg_base;
 	CARD16 status, mask, val;
+	unsigned long long start;
+	GLAMO_TIMING_LOCAL(wait_start);
 
 	if (!mmio)
 		return;
@@ -257,7 +269,21 @@ GLAMOEngineWait(GlamoPtr pGlamo,
 			break;
 	}
 
+	if (pGlamo->sim)
+		GLAMOSimPoll(pGlamo);
+	status = MMIO_IN16(mmio, GLAMO_REG_CMDQ_STATUS);
+	if ((status & mask) == val)
+		return;
+
+	/* Only time the waits which actually have to wait */
+	start = GlamoStatsTime();
+	GLAMO_TIMING_BEGIN(wait_start);
 	do {
+		if (pGlamo->sim)
+			GLAMOSimPoll(pGlamo);
 		status = MMIO_IN16(mmio, GLAMO_REG_CMDQ_STATUS);
     } while ((status & mask) != val);
+	pGlamo->stats.engine_waits++;
+	pGlamo->stats.engine_wait_usec += GlamoStatsTime() - start;
+	GLAMO_TIMING_END(wait_start, GLAMO_PHASE_ENGINE_WAIT);
 }
@@ -329,6 +329,15 @@ static const xf86CrtcFuncsRec crtc_funcs = {
 };
 
 
+/* Return the KMS object id of the CRTC, for page flips and vblank events */
+uint32_t crtc_get_id(xf86CrtcPtr crtc)
+{
+	struct crtc_private *crtcp = crtc->driver_private;
+
+	return crtcp->drm_crtc->crtc_id;
+}
+
+
 void crtc_init(ScrnInfoPtr pScrn)
 {
 	xf86CrtcPtr crtc;
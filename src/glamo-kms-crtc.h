@@ -20,6 +20,10 @@
  *
  */
 
+#include <stdint.h>
+
 #include "xf86.h"
+#include "xf86Crtc.h"
 
 extern void crtc_init(ScrnInfoPtr pScrn);
+extern uint32_t crtc_get_id(xf86CrtcPtr crtc);
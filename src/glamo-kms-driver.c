@@ -72,6 +72,7 @@
 #include "glamo-dri2.h"
 #include "glamo-kms-crtc.h"
 #include "glamo-kms-output.h"
+#include "glamo-capture.h"
 
 
 /* Return TRUE if KMS can be used */
@@ -231,6 +232,8 @@ Bool GlamoKMSPreInit(ScrnInfoPtr pScrn, int flags)
 	pGlamo->drm_fd = drmOpen(NULL, "platform:glamo-fb");
 	if ( pGlamo->drm_fd < 0 ) return FALSE;
 
+	xf86CollectOptions(pScrn, NULL);
+
 	pScrn->monitor = pScrn->confScreen->monitor;
 	pScrn->progClock = TRUE;
 	pScrn->rgbBits = 8;
@@ -306,6 +309,8 @@ static Bool GlamoKMSCloseScreen(int scrnIndex, ScreenPtr pScreen)
 	if ( pGlamo->exa ) {
 		GlamoKMSExaClose(pScrn);
 	}
+	GlamoCaptureClose(pGlamo);
+	GlamoStatsFini(pScrn);
 
 	drmClose(pGlamo->drm_fd);
 	pGlamo->drm_fd = -1;
@@ -415,7 +420,11 @@ Bool GlamoKMSScreenInit(int scrnIndex, ScreenPtr pScreen, int argc,
 
 	xf86SetBlackWhitePixels(pScreen);
 
+	GlamoStatsInit(pScrn);
 	GlamoKMSExaInit(pScrn);
+	GlamoCaptureOpen(pScrn,
+	                 xf86SetStrOption(pScrn->options, "CaptureFile", NULL),
+	                 GLAMO_CAPTURE_SOURCE_DRM);
 
 	miInitializeBackingStore(pScreen);
 	xf86SetBackingStore(pScreen);
@@ -56,6 +56,9 @@
 #include "glamo-regs.h"
 #include "glamo-kms-exa.h"
 #include "glamo-drm.h"
+#include "glamo-dri2.h"
+#include "glamo-render.h"
+#include "glamo-timing.h"
 
 #include <libdrm/glamo_drm.h>
 #include <libdrm/glamo_bo.h>
@@ -64,14 +67,19 @@
 
 
 #if GLAMO_TRACE_FALL
-	#define GLAMO_FALLBACK(x)              \
-	do {                                   \
-		ErrorF("%s: ", __FUNCTION__);  \
-		ErrorF x;                      \
-		return FALSE;                  \
+	#define GLAMO_FALLBACK(reason, x)           \
+	do {                                        \
+		pGlamo->stats.fallbacks[reason]++;  \
+		ErrorF("%s: ", __FUNCTION__);       \
+		ErrorF x;                           \
+		return FALSE;                       \
 	} while (0)
 #else
-	#define GLAMO_FALLBACK(x) return FALSE
+	#define GLAMO_FALLBACK(reason, x)           \
+	do {                                        \
+		pGlamo->stats.fallbacks[reason]++;  \
+		return FALSE;                       \
+	} while (0)
 #endif
 
 
@@ -115,8 +123,215 @@ static const CARD8 GLAMOBltRop[16] = {
 };
 
 
+/*
+ * Video memory pressure.  Pixmaps in video memory are kept on a list in
+ * order of use.  When an allocation fails, the least recently used ones
+ * which neither the engine nor the CPU is using are copied to system
+ * memory and their buffer objects freed.  The CPU then uses the copy in
+ * place, and the next accelerated operation brings the pixmap back.  The
+ * screen pixmap and DRI2 buffers, which others use, are never evicted.
+ */
+
+static void GlamoKMSExaLRURemove(GlamoPtr pGlamo,
+                                 struct glamo_exa_pixmap_priv *priv)
+{
+	if (priv->lru_prev)
+		priv->lru_prev->lru_next = priv->lru_next;
+	else if (pGlamo->lru_first == priv)
+		pGlamo->lru_first = priv->lru_next;
+	else
+		return;		/* Not on the list */
+
+	if (priv->lru_next)
+		priv->lru_next->lru_prev = priv->lru_prev;
+	else
+		pGlamo->lru_last = priv->lru_prev;
+
+	priv->lru_prev = priv->lru_next = NULL;
+}
+
+
+static void GlamoKMSExaLRUTouch(GlamoPtr pGlamo,
+                                struct glamo_exa_pixmap_priv *priv)
+{
+	if (pGlamo->lru_first == priv)
+		return;
+
+	GlamoKMSExaLRURemove(pGlamo, priv);
+
+	priv->lru_next = pGlamo->lru_first;
+	if (pGlamo->lru_first)
+		pGlamo->lru_first->lru_prev = priv;
+	else
+		pGlamo->lru_last = priv;
+	pGlamo->lru_first = priv;
+}
+
+
+/* Put new, which isn't on the list, in old's place */
+static void GlamoKMSExaLRUReplace(GlamoPtr pGlamo,
+                                  struct glamo_exa_pixmap_priv *old,
+                                  struct glamo_exa_pixmap_priv *new)
+{
+	if (!old->lru_prev && pGlamo->lru_first != old)
+		return;		/* Not on the list */
+
+	new->lru_prev = old->lru_prev;
+	new->lru_next = old->lru_next;
+	if (new->lru_prev)
+		new->lru_prev->lru_next = new;
+	else
+		pGlamo->lru_first = new;
+	if (new->lru_next)
+		new->lru_next->lru_prev = new;
+	else
+		pGlamo->lru_last = new;
+
+	old->lru_prev = old->lru_next = NULL;
+}
+
+
+/* The last submission a CPU access to a pixmap has to wait for: the last
+ * one writing to it, or for writes, the last one using it at all */
+static unsigned int GlamoKMSExaPixmapSeq(struct glamo_exa_pixmap_priv *priv,
+                                         Bool write)
+{
+	unsigned int seq = priv->write_seq;
+
+	if (write && GLAMO_SEQ_AFTER(priv->read_seq, seq))
+		seq = priv->read_seq;
+
+	return seq;
+}
+
+
+/* Whether the engine may still be using a pixmap.  Clients render to
+ * exported pixmaps too, which no fence of ours covers, so only the kernel
+ * knows about those. */
+static Bool GlamoKMSExaPixmapBusy(GlamoPtr pGlamo,
+                                  struct glamo_exa_pixmap_priv *priv,
+                                  Bool write)
+{
+	uint32_t domain;
+
+	if (priv->exported) {
+		GlamoDRMDrain(pGlamo);
+		return glamo_bo_is_busy(priv->bo, &domain);
+	}
+
+	return GlamoDRMFenceBusy(pGlamo, GlamoKMSExaPixmapSeq(priv, write),
+	                         priv->bo);
+}
+
+
+/* Copy a pixmap to system memory and free its buffer object */
+static Bool GlamoKMSExaEvict(GlamoPtr pGlamo,
+                             struct glamo_exa_pixmap_priv *priv)
+{
+	struct glamo_bo *bo = priv->bo;
+
+	if (priv->pinned || priv->exported || priv->mapped)
+		return FALSE;
+	if (GlamoKMSExaPixmapBusy(pGlamo, priv, TRUE))
+		return FALSE;
+	if (!bo->virtual && glamo_bo_map(bo, 1))
+		return FALSE;
+
+	priv->sys_backing = malloc(priv->size);
+	if (!priv->sys_backing)
+		return FALSE;
+	memcpy(priv->sys_backing, bo->virtual, priv->size);
+
+	GlamoKMSExaLRURemove(pGlamo, priv);
+	GlamoDRMFenceIdle(pGlamo, bo);
+	if (pGlamo->last_buffer_object == bo)
+		pGlamo->last_buffer_object = NULL;
+	glamo_bo_unref(bo);
+	priv->bo = NULL;
+
+	pGlamo->stats.bo_frees++;
+	pGlamo->stats.evictions++;
+
+	return TRUE;
+}
+
+
+/* Evict pixmaps, least recently used first, until at least size bytes
+ * have been freed.  Returns FALSE if none could be evicted. */
+static Bool GlamoKMSExaEvictLRU(GlamoPtr pGlamo, int size)
+{
+	struct glamo_exa_pixmap_priv *priv, *prev;
+	int freed = 0;
+
+	for (priv = pGlamo->lru_last; priv && freed < size; priv = prev) {
+		prev = priv->lru_prev;
+		if (GlamoKMSExaEvict(pGlamo, priv))
+			freed += priv->size;
+	}
+
+	return freed > 0;
+}
+
+
+/* Allocate video memory, evicting other pixmaps to make room for it */
+static struct glamo_bo *GlamoKMSExaAllocBO(GlamoPtr pGlamo, int size,
+                                           int align)
+{
+	struct glamo_bo *bo;
+
+	do {
+		/* Dive into the kernel (via libdrm) to allocate some VRAM */
+		bo = glamo_bo_open(pGlamo->bufmgr, 0, size, align,
+		                   GLAMO_GEM_DOMAIN_VRAM, 0);
+		if (bo) {
+			pGlamo->stats.bo_allocs++;
+			return bo;
+		}
+		/* DRI2 buffers kept for reuse go first, as nobody uses them */
+	} while (driPoolRelease(pGlamo->pScreen) ||
+	         GlamoKMSExaEvictLRU(pGlamo, size));
+
+	return NULL;
+}
+
+
+/* Make sure a pixmap is in video memory, for the engine to use it */
+static Bool GlamoKMSExaToVRAM(GlamoPtr pGlamo,
+                              struct glamo_exa_pixmap_priv *priv)
+{
+	if (!priv)
+		return FALSE;
+
+	if (!priv->bo) {
+		if (!priv->sys_backing)
+			return FALSE;
+
+		priv->bo = GlamoKMSExaAllocBO(pGlamo, priv->size, 2);
+		if (!priv->bo)
+			return FALSE;
+		if (glamo_bo_map(priv->bo, 1)) {
+			glamo_bo_unref(priv->bo);
+			priv->bo = NULL;
+			pGlamo->stats.bo_frees++;
+			return FALSE;
+		}
+
+		memcpy(priv->bo->virtual, priv->sys_backing, priv->size);
+		free(priv->sys_backing);
+		priv->sys_backing = NULL;
+		pGlamo->stats.restores++;
+	}
+
+	if (!priv->pinned)
+		GlamoKMSExaLRUTouch(pGlamo, priv);
+
+	return TRUE;
+}
+
+
 unsigned int driGetPixmapHandle(PixmapPtr pPixmap, unsigned int *flags)
 {
+	ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
 	struct glamo_exa_pixmap_priv *priv;
 
 	priv = exaGetPixmapDriverPrivate(pPixmap);
@@ -125,10 +340,64 @@ unsigned int driGetPixmapHandle(PixmapPtr pPixmap, unsigned int *flags)
 		return 0;
 	}
 
+	if (!GlamoKMSExaToVRAM(GlamoPTR(pScrn), priv))
+		return 0;
+
 	return priv->bo->handle;
 }
 
 
+/* Prepare a pixmap to be shared with DRI2 clients, which use its buffer
+ * object directly: it has to stay in video memory, and be accessed there */
+Bool GlamoKMSExaExportPixmap(PixmapPtr pPix)
+{
+	ScrnInfoPtr pScrn = xf86Screens[pPix->drawable.pScreen->myNum];
+	struct glamo_exa_pixmap_priv *priv;
+
+	priv = exaGetPixmapDriverPrivate(pPix);
+	if (!GlamoKMSExaToVRAM(GlamoPTR(pScrn), priv))
+		return FALSE;
+
+	priv->exported = TRUE;
+	priv->prefer_sys = FALSE;
+
+	return TRUE;
+}
+
+
+/* Exchange the buffer objects of two pixmaps in video memory, for a DRI2
+ * page flip, along with everything which goes with the buffer: its
+ * fences, size and flags, and its place in order of use */
+void GlamoKMSExaExchangeBOs(PixmapPtr pA, PixmapPtr pB)
+{
+	ScrnInfoPtr pScrn = xf86Screens[pA->drawable.pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	struct glamo_exa_pixmap_priv *a = exaGetPixmapDriverPrivate(pA);
+	struct glamo_exa_pixmap_priv *b = exaGetPixmapDriverPrivate(pB);
+	struct glamo_exa_pixmap_priv tmp, mark;
+
+	tmp = *a;
+	a->bo = b->bo;
+	a->read_seq = b->read_seq;
+	a->write_seq = b->write_seq;
+	a->size = b->size;
+	a->exported = b->exported;
+	a->pinned = b->pinned;
+	b->bo = tmp.bo;
+	b->read_seq = tmp.read_seq;
+	b->write_seq = tmp.write_seq;
+	b->size = tmp.size;
+	b->exported = tmp.exported;
+	b->pinned = tmp.pinned;
+
+	/* Each takes the other's place on the list, by way of a marker */
+	mark.lru_prev = mark.lru_next = NULL;
+	GlamoKMSExaLRUReplace(pGlamo, a, &mark);
+	GlamoKMSExaLRUReplace(pGlamo, b, a);
+	GlamoKMSExaLRUReplace(pGlamo, &mark, b);
+}
+
+
 static Bool GlamoKMSExaPrepareSolid(PixmapPtr pPix, int alu, Pixel pm, Pixel fg)
 {
 	ScrnInfoPtr pScrn = xf86Screens[pPix->drawable.pScreen->myNum];
@@ -136,35 +405,111 @@ static Bool GlamoKMSExaPrepareSolid(PixmapPtr pPix, int alu, Pixel pm, Pixel fg)
 	CARD16 op, pitch;
 	FbBits mask;
 	struct glamo_exa_pixmap_priv *priv = exaGetPixmapDriverPrivate(pPix);
+	GLAMO_TIMING_LOCAL(start);
 
+	GLAMO_TIMING_BEGIN(start);
 	if (pPix->drawable.bitsPerPixel != 16) {
-		GLAMO_FALLBACK(("Only 16bpp is supported\n"));
+		GLAMO_FALLBACK(GLAMO_FALLBACK_BPP,
+			       ("Only 16bpp is supported\n"));
 	}
 
 	mask = FbFullMask(16);
 	if ((pm & mask) != mask) {
-		GLAMO_FALLBACK(("Can't do planemask 0x%08x\n",
+		GLAMO_FALLBACK(GLAMO_FALLBACK_PLANEMASK,
+			       ("Can't do planemask 0x%08x\n",
 		               (unsigned int)pm));
 	}
 
 	op = GLAMOSolidRop[alu] << 8;
 	pitch = pPix->devKind;
 
+	if (pitch > GLAMO_2D_MAX_PITCH ||
+	    pPix->drawable.height > GLAMO_2D_MAX_COORD) {
+		GLAMO_FALLBACK(GLAMO_FALLBACK_SIZE,
+			       ("%ix%i pixmap is too large\n",
+			        pPix->drawable.width, pPix->drawable.height));
+	}
+
+	if (!GlamoKMSExaToVRAM(pGlamo, priv)) {
+		GLAMO_FALLBACK(GLAMO_FALLBACK_VRAM,
+			       ("No video memory for the pixmap\n"));
+	}
+
 	GlamoDRMAddCommandBO(pGlamo, GLAMO_REG_2D_DST_ADDRL, priv->bo);
 	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_DST_PITCH, pitch & 0x7ff);
 	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_DST_HEIGHT, pPix->drawable.height);
 	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_PAT_FG, fg);
 	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_COMMAND2, op);
 
+	GLAMO_TIMING_END(start, GLAMO_PHASE_PREPARE);
+	GLAMO_TIMING_EMIT_BEGIN();
 	return TRUE;
 }
 
 
+/*
+ * Placement of mixed pixmaps.  Video memory is uncached and slow for the
+ * CPU to read, so the CPU accesses to pixmaps mostly drawn in software are
+ * better left to EXA's copy in system memory, which it keeps in step with
+ * DownloadFromScreen() and UploadToScreen() when the pixmap changes hands.
+ * A pixmap moves when its usage balance reaches one of the thresholds,
+ * which are far enough apart that one used both ways doesn't ping-pong.
+ */
+#define GLAMO_USAGE_ACCEL	4	/* accelerated operation */
+#define GLAMO_USAGE_CPU_READ	2	/* CPU access as a source */
+#define GLAMO_USAGE_CPU_WRITE	1	/* CPU access as a destination */
+#define GLAMO_USAGE_TO_SYS	(-16)
+#define GLAMO_USAGE_TO_VRAM	16
+#define GLAMO_USAGE_LIMIT	32
+
+static void GlamoKMSExaPlace(GlamoPtr pGlamo,
+                             struct glamo_exa_pixmap_priv *priv, int delta)
+{
+	priv->usage = max(-GLAMO_USAGE_LIMIT,
+	                  min(GLAMO_USAGE_LIMIT, priv->usage + delta));
+
+	/* Others see these pixmaps in video memory */
+	if (priv->pinned || priv->exported) {
+		priv->prefer_sys = FALSE;
+		return;
+	}
+
+	if (!priv->prefer_sys && priv->usage <= GLAMO_USAGE_TO_SYS) {
+		priv->prefer_sys = TRUE;
+		pGlamo->stats.placed_sys++;
+	} else if (priv->prefer_sys && priv->usage >= GLAMO_USAGE_TO_VRAM) {
+		priv->prefer_sys = FALSE;
+		pGlamo->stats.placed_vram++;
+	}
+}
+
+
+/* Note that the last submission reads from or writes to a pixmap */
+static void GlamoKMSExaMarkPixmap(GlamoPtr pGlamo, PixmapPtr pPix, Bool write)
+{
+	struct glamo_exa_pixmap_priv *priv = exaGetPixmapDriverPrivate(pPix);
+
+	if (!priv)
+		return;
+
+	GlamoKMSExaPlace(pGlamo, priv, GLAMO_USAGE_ACCEL);
+
+	if (write)
+		priv->write_seq = pGlamo->fence_seq;
+	else
+		priv->read_seq = pGlamo->fence_seq;
+
+	if (priv->exported)
+		pGlamo->exported_seq = pGlamo->fence_seq;
+}
+
+
 static void GlamoKMSExaSolid(PixmapPtr pPix, int x1, int y1, int x2, int y2)
 {
 	ScrnInfoPtr pScrn = xf86Screens[pPix->drawable.pScreen->myNum];
 	GlamoPtr pGlamo = GlamoPTR(pScrn);
 
+	GLAMO_STAT_OP(pGlamo, GLAMO_STAT_SOLID);
 	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_DST_X, x1);
 	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_DST_Y, y1);
 	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_RECT_WIDTH, x2 - x1);
@@ -178,7 +523,9 @@ static void GlamoKMSExaDoneSolid(PixmapPtr pPix)
 	ScrnInfoPtr pScrn = xf86Screens[pPix->drawable.pScreen->myNum];
 	GlamoPtr pGlamo = GlamoPTR(pScrn);
 
+	GLAMO_TIMING_EMIT_END();
 	GlamoDRMDispatch(pGlamo);
+	GlamoKMSExaMarkPixmap(pGlamo, pPix, TRUE);
 	exaMarkSync(pGlamo->pScreen);
 }
 
@@ -193,24 +540,43 @@ static Bool GlamoKMSExaPrepareCopy(PixmapPtr pSrc, PixmapPtr pDst, int dx, int d
 	CARD16 op;
 	struct glamo_exa_pixmap_priv *priv_src;
 	struct glamo_exa_pixmap_priv *priv_dst;
+	GLAMO_TIMING_LOCAL(start);
 
+	GLAMO_TIMING_BEGIN(start);
 	priv_src = exaGetPixmapDriverPrivate(pSrc);
 	priv_dst = exaGetPixmapDriverPrivate(pDst);
 
 	if (pSrc->drawable.bitsPerPixel != 16 ||
 	    pDst->drawable.bitsPerPixel != 16) {
-		GLAMO_FALLBACK(("Only 16bpp is supported"));
+		GLAMO_FALLBACK(GLAMO_FALLBACK_BPP,
+			       ("Only 16bpp is supported"));
 	}
 
 	mask = FbFullMask(16);
 	if ((pm & mask) != mask) {
-		GLAMO_FALLBACK(("Can't do planemask 0x%08x",
+		GLAMO_FALLBACK(GLAMO_FALLBACK_PLANEMASK,
+			       ("Can't do planemask 0x%08x",
 				(unsigned int) pm));
 	}
 
 	src_pitch = pSrc->devKind;
 	dst_pitch = pDst->devKind;
+
+	if (src_pitch > GLAMO_2D_MAX_PITCH || dst_pitch > GLAMO_2D_MAX_PITCH ||
+	    pSrc->drawable.height > GLAMO_2D_MAX_COORD ||
+	    pDst->drawable.height > GLAMO_2D_MAX_COORD) {
+		GLAMO_FALLBACK(GLAMO_FALLBACK_SIZE,
+			       ("Pixmaps are too large\n"));
+	}
+
+	/* Bringing one back may evict the other */
+	if (!GlamoKMSExaToVRAM(pGlamo, priv_src) ||
+	    !GlamoKMSExaToVRAM(pGlamo, priv_dst) || !priv_src->bo) {
+		GLAMO_FALLBACK(GLAMO_FALLBACK_VRAM,
+			       ("No video memory for the pixmaps\n"));
+	}
 	op = GLAMOBltRop[alu] << 8;
+	pGlamo->copy_src = pSrc;
 
 	GlamoDRMAddCommandBO(pGlamo, GLAMO_REG_2D_SRC_ADDRL, priv_src->bo);
 	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_SRC_PITCH, src_pitch & 0x7ff);
@@ -221,6 +587,8 @@ static Bool GlamoKMSExaPrepareCopy(PixmapPtr pSrc, PixmapPtr pDst, int dx, int d
 
 	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_COMMAND2, op);
 
+	GLAMO_TIMING_END(start, GLAMO_PHASE_PREPARE);
+	GLAMO_TIMING_EMIT_BEGIN();
 	return TRUE;
 }
 
@@ -231,6 +599,7 @@ static void GlamoKMSExaCopy(PixmapPtr pDst, int srcX, int srcY,
 	ScrnInfoPtr pScrn = xf86Screens[pDst->drawable.pScreen->myNum];
 	GlamoPtr pGlamo = GlamoPTR(pScrn);
 
+	GLAMO_STAT_OP(pGlamo, GLAMO_STAT_COPY);
 	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_SRC_X, srcX);
 	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_SRC_Y, srcY);
 	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_DST_X, dstX);
@@ -246,50 +615,78 @@ static void GlamoKMSExaDoneCopy(PixmapPtr pDst)
 	ScrnInfoPtr pScrn = xf86Screens[pDst->drawable.pScreen->myNum];
 	GlamoPtr pGlamo = GlamoPTR(pScrn);
 
+	GLAMO_TIMING_EMIT_END();
 	GlamoDRMDispatch(pGlamo);
+	GlamoKMSExaMarkPixmap(pGlamo, pGlamo->copy_src, FALSE);
+	GlamoKMSExaMarkPixmap(pGlamo, pDst, TRUE);
 	exaMarkSync(pGlamo->pScreen);
 }
 
 
-/* Generate an integer token which can be used for synchronisation later.
- * We do this by putting the most recently used buffer object into a list,
- * and returning the index into that list.
- * To make things a little more exciting, the list is a ring buffer. */
-static int GlamoKMSExaMarkSync(ScreenPtr pScreen)
+/* Copy a list of boxes between two pixmaps as one command submission,
+ * without going through a GC.  The boxes are in the coordinates of the
+ * destination, offset by (src_dx, src_dy) in the source.
+ * Returns FALSE, having done nothing, if the blitter can't do the copy. */
+Bool GlamoKMSExaCopyBoxes(PixmapPtr pSrc, PixmapPtr pDst, BoxPtr boxes,
+                          int nbox, int src_dx, int src_dy)
 {
-	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
-	GlamoPtr pGlamo = GlamoPTR(pScrn);
-	unsigned int idx;
+	struct glamo_exa_pixmap_priv *priv_src;
+	struct glamo_exa_pixmap_priv *priv_dst;
+	int i;
+
+	priv_src = exaGetPixmapDriverPrivate(pSrc);
+	priv_dst = exaGetPixmapDriverPrivate(pDst);
+	if ( !priv_src || (!priv_src->bo && !priv_src->sys_backing) )
+		return FALSE;
+	if ( !priv_dst || (!priv_dst->bo && !priv_dst->sys_backing) )
+		return FALSE;
 
-	idx = pGlamo->exa_marker_index;
-	pGlamo->exa_buffer_markers[idx] = pGlamo->last_buffer_object;
+	if ( nbox == 0 ) return TRUE;
 
-	pGlamo->exa_marker_index = (idx+1) % NUM_EXA_BUFFER_MARKERS;
+	if ( !GlamoKMSExaPrepareCopy(pSrc, pDst, 0, 0, GXcopy, FB_ALLONES) ) {
+		return FALSE;
+	}
+
+	for ( i=0; i<nbox; i++ ) {
+		GlamoKMSExaCopy(pDst, boxes[i].x1 + src_dx, boxes[i].y1 + src_dy,
+		                boxes[i].x1, boxes[i].y1,
+		                boxes[i].x2 - boxes[i].x1,
+		                boxes[i].y2 - boxes[i].y1);
+	}
 
-	return 1;
+	GlamoKMSExaDoneCopy(pDst);
+
+	return TRUE;
 }
 
 
-static void GlamoKMSExaWaitMarker(ScreenPtr pScreen, int idx)
+/* Generate an integer token which can be used for synchronisation later:
+ * the fence of the last submission, which the operations EXA is marking
+ * have always been dispatched in. */
+static int GlamoKMSExaMarkSync(ScreenPtr pScreen)
 {
 	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
 	GlamoPtr pGlamo = GlamoPTR(pScrn);
-	struct glamo_bo *bo;
 
-	bo = pGlamo->exa_buffer_markers[idx];
+	return pGlamo->fence_seq;
+}
 
-	if ( bo ) {
-		glamo_bo_wait(bo);
-	} else {
 
-		struct drm_glamo_gem_wait_rendering args;
+static void GlamoKMSExaWaitMarker(ScreenPtr pScreen, int marker)
+{
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	unsigned long long start;
+	GLAMO_TIMING_LOCAL(wait_start);
+
+	start = GlamoStatsTime();
+	GLAMO_TIMING_BEGIN(wait_start);
 
-		args.handle = 0;
-		args.have_handle = 0;
-		drmCommandWriteRead(pGlamo->bufmgr->fd,
-				    DRM_GLAMO_GEM_WAIT_RENDERING,
-				    &args, sizeof(args));
-	}
+	if ( !GlamoDRMFenceWait(pGlamo, marker) ) return;
+
+	pGlamo->stats.engine_waits++;
+	pGlamo->stats.engine_wait_usec += GlamoStatsTime() - start;
+	GLAMO_TIMING_END(wait_start, GLAMO_PHASE_ENGINE_WAIT);
 }
 
 
@@ -307,15 +704,15 @@ static void *GlamoKMSExaCreatePixmap(ScreenPtr screen, int size, int align)
 	if (size == 0)
 		return new_priv;
 
-	/* Dive into the kernel (via libdrm) to allocate some VRAM */
-	new_priv->bo = glamo_bo_open(pGlamo->bufmgr, 0, size, align,
-	                             GLAMO_GEM_DOMAIN_VRAM, 0);
+	new_priv->bo = GlamoKMSExaAllocBO(pGlamo, size, align);
 	if (!new_priv->bo) {
 		free(new_priv);
 		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
 		           "Failed to create pixmap\n");
 		return NULL;
 	}
+	new_priv->size = size;
+	GlamoKMSExaLRUTouch(pGlamo, new_priv);
 
 	return new_priv;
 }
@@ -326,22 +723,20 @@ static void GlamoKMSExaDestroyPixmap(ScreenPtr pScreen, void *driverPriv)
 	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
 	GlamoPtr pGlamo = GlamoPTR(pScrn);
 	struct glamo_exa_pixmap_priv *driver_priv = driverPriv;
-	int i;
 
-	/* We're about to (probably) delete a buffer object, so zip through
-	 * the list of EXA wait markers and delete any references. */
-	for ( i=0; i<NUM_EXA_BUFFER_MARKERS; i++ ) {
-		if ( pGlamo->exa_buffer_markers[i] == driver_priv->bo ) {
-			pGlamo->exa_buffer_markers[i] = NULL;
-		}
-	}
+	/* Fences hold their own references to the buffer objects they wait
+	 * on, but the commands still being prepared don't */
 	if ( pGlamo->last_buffer_object == driver_priv->bo ) {
 		pGlamo->last_buffer_object = NULL;
 	}
 
-	if (driver_priv->bo)
+	if (driver_priv->bo) {
 		glamo_bo_unref(driver_priv->bo);
+		pGlamo->stats.bo_frees++;
+	}
 
+	GlamoKMSExaLRURemove(pGlamo, driver_priv);
+	free(driver_priv->sys_backing);
 	free(driver_priv);
 }
 
@@ -350,19 +745,220 @@ static Bool GlamoKMSExaPixmapIsOffscreen(PixmapPtr pPix)
 {
 	struct glamo_exa_pixmap_priv *driver_priv;
 
+	/* Evicted pixmaps still count, since they are brought back for the
+	 * next accelerated operation */
 	driver_priv = exaGetPixmapDriverPrivate(pPix);
-	if (driver_priv && driver_priv->bo)
+	if (driver_priv && (driver_priv->bo || driver_priv->sys_backing))
 		return TRUE;
 
 	return FALSE;
 }
 
 
+/* Wait for the engine to finish with a pixmap before the CPU reads it, or
+ * also writes to it.  Reading only has to wait for the submissions which
+ * write to the pixmap, and a busy query saves waiting on one which the
+ * engine is done with. */
+static void GlamoKMSExaWaitPixmap(GlamoPtr pGlamo,
+                                  struct glamo_exa_pixmap_priv *priv,
+                                  Bool write)
+{
+	GLAMO_TIMING_LOCAL(start);
+
+	if (!GlamoKMSExaPixmapBusy(pGlamo, priv, write))
+		return;
+
+	GLAMO_TIMING_BEGIN(start);
+	if (priv->exported)
+		glamo_bo_wait(priv->bo);
+	else
+		GlamoDRMFenceWait(pGlamo, GlamoKMSExaPixmapSeq(priv, write));
+	GLAMO_TIMING_END(start, GLAMO_PHASE_ACCESS_WAIT);
+}
+
+
+/* Map a pixmap's buffer object and wait for the rendering it depends on
+ * to finish.  Returns the address of (x, y) in the pixmap. */
+static unsigned char *GlamoKMSExaMapRect(GlamoPtr pGlamo, PixmapPtr pPix,
+                                         int x, int y, Bool write)
+{
+	struct glamo_exa_pixmap_priv *priv;
+
+	unsigned char *base;
+
+	priv = exaGetPixmapDriverPrivate(pPix);
+	if (!priv)
+		return NULL;
+
+	/* See GlamoKMSExaPrepareAccess() */
+	if (priv->bo && pPix->drawable.bitsPerPixel != 16)
+		GlamoKMSExaEvict(pGlamo, priv);
+
+	if (priv->bo) {
+		if (!priv->bo->virtual && glamo_bo_map(priv->bo, 1))
+			return NULL;
+		GlamoKMSExaWaitPixmap(pGlamo, priv, write);
+		base = priv->bo->virtual;
+	} else if (priv->sys_backing) {
+		base = priv->sys_backing;
+	} else {
+		return NULL;
+	}
+
+	return base + y * pPix->devKind + x * pPix->drawable.bitsPerPixel / 8;
+}
+
+
+/* Find a staging buffer object the engine is done with, allocating them
+ * as they are first needed, and store its slot in *slot.  Returns NULL if
+ * they are all busy. */
+static struct glamo_bo *GlamoKMSExaStagingBO(GlamoPtr pGlamo, int *slot)
+{
+	struct glamo_bo *bo;
+	int i, n;
+
+	for (i = 0; i < GLAMO_KMS_STAGING_SLOTS; i++) {
+		n = (pGlamo->staging_next + i) % GLAMO_KMS_STAGING_SLOTS;
+		bo = pGlamo->staging_bo[n];
+
+		if (!bo) {
+			bo = glamo_bo_open(pGlamo->bufmgr, 0,
+			                   GLAMO_STAGING_SIZE
+			                    / GLAMO_KMS_STAGING_SLOTS,
+			                   2, GLAMO_GEM_DOMAIN_VRAM, 0);
+			if (!bo)
+				return NULL;
+			pGlamo->stats.bo_allocs++;
+			if (glamo_bo_map(bo, 1)) {
+				glamo_bo_unref(bo);
+				pGlamo->stats.bo_frees++;
+				return NULL;
+			}
+			pGlamo->staging_bo[n] = bo;
+		} else if (GlamoDRMFenceBusy(pGlamo, pGlamo->staging_seq[n],
+		                             bo)) {
+			continue;
+		}
+
+		pGlamo->staging_next = (n + 1) % GLAMO_KMS_STAGING_SLOTS;
+		*slot = n;
+		return bo;
+	}
+
+	return NULL;
+}
+
+
+/* Write an upload to a staging buffer object and submit a blit from there
+ * to the pixmap, behind the rendering still using it, instead of waiting
+ * for it.  Returns FALSE if the blitter can't do it. */
+static Bool GlamoKMSExaStagedUpload(GlamoPtr pGlamo, PixmapPtr pDst,
+                                    int x, int y, int w, int h,
+                                    char *src, int src_pitch)
+{
+	struct glamo_exa_pixmap_priv *priv = exaGetPixmapDriverPrivate(pDst);
+	struct glamo_bo *bo;
+	int pitch = w * 2;
+	int slot;
+
+	if (pDst->drawable.bitsPerPixel != 16 ||
+	    pDst->devKind > GLAMO_2D_MAX_PITCH ||
+	    pDst->drawable.height > GLAMO_2D_MAX_COORD ||
+	    pitch * h > GLAMO_STAGING_SIZE / GLAMO_KMS_STAGING_SLOTS)
+		return FALSE;
+
+	bo = GlamoKMSExaStagingBO(pGlamo, &slot);
+	if (!bo)
+		return FALSE;
+
+	GlamoCopyRows(bo->virtual, pitch, (unsigned char *)src, src_pitch,
+	              pitch, h);
+
+	GlamoDRMAddCommandBO(pGlamo, GLAMO_REG_2D_SRC_ADDRL, bo);
+	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_SRC_PITCH, pitch & 0x7ff);
+	GlamoDRMAddCommandBO(pGlamo, GLAMO_REG_2D_DST_ADDRL, priv->bo);
+	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_DST_PITCH,
+	                   pDst->devKind & 0x7ff);
+	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_DST_HEIGHT,
+	                   pDst->drawable.height);
+	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_COMMAND2,
+	                   GLAMOBltRop[GXcopy] << 8);
+	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_SRC_X, 0);
+	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_SRC_Y, 0);
+	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_DST_X, x);
+	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_DST_Y, y);
+	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_RECT_WIDTH, w);
+	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_RECT_HEIGHT, h);
+	GlamoDRMAddCommand(pGlamo, GLAMO_REG_2D_COMMAND3, 0);
+
+	GlamoDRMDispatch(pGlamo);
+	GlamoKMSExaMarkPixmap(pGlamo, pDst, TRUE);
+	pGlamo->staging_seq[slot] = pGlamo->fence_seq;
+	exaMarkSync(pGlamo->pScreen);
+	GLAMO_STAT_OP(pGlamo, GLAMO_STAT_STAGED_UPLOAD);
+
+	return TRUE;
+}
+
+
+static Bool GlamoKMSExaUploadToScreen(PixmapPtr pDst, int x, int y,
+                                      int w, int h,
+                                      char *src, int src_pitch)
+{
+	ScrnInfoPtr pScrn = xf86Screens[pDst->drawable.pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	struct glamo_exa_pixmap_priv *priv;
+	unsigned char *dst;
+
+	/* Writing directly is cheapest, unless the engine still uses the
+	 * pixmap */
+	priv = exaGetPixmapDriverPrivate(pDst);
+	if (priv && priv->bo && GlamoKMSExaPixmapBusy(pGlamo, priv, TRUE) &&
+	    GlamoKMSExaStagedUpload(pGlamo, pDst, x, y, w, h,
+	                            src, src_pitch)) {
+		GLAMO_STAT_OP(pGlamo, GLAMO_STAT_UPLOAD);
+		return TRUE;
+	}
+
+	dst = GlamoKMSExaMapRect(pGlamo, pDst, x, y, TRUE);
+	if (!dst)
+		return FALSE;
+
+	GLAMO_STAT_OP(pGlamo, GLAMO_STAT_UPLOAD);
+	GlamoCopyRows(dst, pDst->devKind, (unsigned char *)src, src_pitch,
+	              w * pDst->drawable.bitsPerPixel / 8, h);
+
+	return TRUE;
+}
+
+
+static Bool GlamoKMSExaDownloadFromScreen(PixmapPtr pSrc, int x, int y,
+                                          int w, int h,
+                                          char *dst, int dst_pitch)
+{
+	ScrnInfoPtr pScrn = xf86Screens[pSrc->drawable.pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	unsigned char *src;
+
+	src = GlamoKMSExaMapRect(pGlamo, pSrc, x, y, FALSE);
+	if (!src)
+		return FALSE;
+
+	GLAMO_STAT_OP(pGlamo, GLAMO_STAT_DOWNLOAD);
+	GlamoCopyRows((unsigned char *)dst, dst_pitch, src, pSrc->devKind,
+	              w * pSrc->drawable.bitsPerPixel / 8, h);
+
+	return TRUE;
+}
+
+
 static Bool GlamoKMSExaPrepareAccess(PixmapPtr pPix, int index)
 {
 	ScreenPtr screen = pPix->drawable.pScreen;
 	ScrnInfoPtr pScrn = xf86Screens[screen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
 	struct glamo_exa_pixmap_priv *driver_priv;
+	Bool write;
 
 	driver_priv = exaGetPixmapDriverPrivate(pPix);
 	if (!driver_priv) {
@@ -371,16 +967,40 @@ static Bool GlamoKMSExaPrepareAccess(PixmapPtr pPix, int index)
 		return FALSE;
 	}
 
+	/* The 2D engine only draws 16 bit pixmaps, so the others (glyph
+	 * masks, EXA's glyph caches, ARGB images) are only ever used by the
+	 * CPU, which reads them much faster from cached system memory */
+	if (driver_priv->bo && pPix->drawable.bitsPerPixel != 16)
+		GlamoKMSExaEvict(pGlamo, driver_priv);
+
+	/* Evicted pixmaps are accessed where they are */
+	if (!driver_priv->bo && driver_priv->sys_backing) {
+		pPix->devPrivate.ptr = driver_priv->sys_backing;
+		driver_priv->mapped = TRUE;
+		return TRUE;
+	}
+
 	if (!driver_priv->bo) {
 		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
 				"%s: no buffer object?\n", __FUNCTION__);
 		return TRUE;
 	}
 
+	GLAMO_STAT_OP(pGlamo, GLAMO_STAT_CPU_ACCESS);
+	write = index != EXA_PREPARE_SRC && index != EXA_PREPARE_MASK;
+
+	GlamoKMSExaPlace(pGlamo, driver_priv, write ? -GLAMO_USAGE_CPU_WRITE
+	                                            : -GLAMO_USAGE_CPU_READ);
+#ifdef EXA_MIXED_PIXMAPS
+	/* EXA falls back to its own copy in system memory */
+	if ( driver_priv->prefer_sys ) return FALSE;
+#endif
+
 	/* Return as quickly as possible if we have a mapping already */
 	if ( driver_priv->bo->virtual ) {
 		pPix->devPrivate.ptr = driver_priv->bo->virtual;
-		glamo_bo_wait(driver_priv->bo);
+		driver_priv->mapped = TRUE;
+		GlamoKMSExaWaitPixmap(pGlamo, driver_priv, write);
 		return TRUE;
 	}
 
@@ -390,7 +1010,8 @@ static Bool GlamoKMSExaPrepareAccess(PixmapPtr pPix, int index)
 		return FALSE;
 	}
 	pPix->devPrivate.ptr = driver_priv->bo->virtual;
-	glamo_bo_wait(driver_priv->bo);
+	driver_priv->mapped = TRUE;
+	GlamoKMSExaWaitPixmap(pGlamo, driver_priv, write);
 
 	return TRUE;
 }
@@ -398,8 +1019,14 @@ static Bool GlamoKMSExaPrepareAccess(PixmapPtr pPix, int index)
 
 static void GlamoKMSExaFinishAccess(PixmapPtr pPix, int index)
 {
+	struct glamo_exa_pixmap_priv *driver_priv;
+
 	/* Leave the mapping intact for fast restoration of access later */
 	pPix->devPrivate.ptr = NULL;
+
+	driver_priv = exaGetPixmapDriverPrivate(pPix);
+	if (driver_priv)
+		driver_priv->mapped = FALSE;
 }
 
 
@@ -429,6 +1056,7 @@ Bool GlamoKMSExaMakeFullyFledged(PixmapPtr pPix, int width, int height,
 		FatalError("Fledgeling pixmap had no driver private!\n");
 		return FALSE;
 	}
+	priv->pinned = TRUE;
 
 	new_size = (width * height * depth) / 8;
 	if ( new_size == 0 ) {
@@ -443,14 +1071,14 @@ Bool GlamoKMSExaMakeFullyFledged(PixmapPtr pPix, int width, int height,
 
 		/* This pixmap has no associated buffer object.
 		 * It's time to create one */
-		priv->bo = glamo_bo_open(pGlamo->bufmgr, 0, new_size, 2,
-		                         GLAMO_GEM_DOMAIN_VRAM, 0);
+		priv->bo = GlamoKMSExaAllocBO(pGlamo, new_size, 2);
 		if ( priv->bo == NULL ) {
 			xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
 				   "Couldn't create buffer object for"
 				   " fledgeling pixmap!\n");
 			return FALSE;
 		}
+		priv->size = new_size;
 
 	} else {
 
@@ -468,7 +1096,16 @@ Bool GlamoKMSExaCheckComposite(int op,
                                PicturePtr pMaskPicture,
                                PicturePtr pDstPicture)
 {
-	return FALSE;
+	ScreenPtr pScreen = pDstPicture->pDrawable->pScreen;
+	GlamoPtr pGlamo = GlamoPTR(xf86Screens[pScreen->myNum]);
+
+	if (GLAMOCompositeCheck(op, pSrcPicture, pMaskPicture, pDstPicture)
+	    == GLAMO_COMPOSITE_NONE) {
+		GLAMO_FALLBACK(GLAMO_FALLBACK_COMPOSITE,
+			       ("Composite op %i\n", op));
+	}
+
+	return TRUE;
 }
 
 
@@ -480,7 +1117,39 @@ Bool GlamoKMSExaPrepareComposite(int op,
                                  PixmapPtr pMask,
                                  PixmapPtr pDst)
 {
-	return FALSE;
+	ScrnInfoPtr pScrn = xf86Screens[pDst->drawable.pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	unsigned char *src;
+	CARD32 pixel = 0;
+	Pixel fill;
+
+	pGlamo->composite = GLAMOCompositeCheck(op, pSrcPicture, pMaskPicture,
+	                                        pDstPicture);
+	switch (pGlamo->composite) {
+	case GLAMO_COMPOSITE_COPY:
+		return GlamoKMSExaPrepareCopy(pSrc, pDst, 0, 0, GXcopy,
+		                              FB_ALLONES);
+
+	case GLAMO_COMPOSITE_FILL:
+		/* Read the colour of a 1x1 source */
+		if (pSrc && pSrcPicture->pDrawable && op != PictOpClear) {
+			src = GlamoKMSExaMapRect(pGlamo, pSrc, 0, 0, FALSE);
+			if (!src)
+				return FALSE;
+			if (pSrc->drawable.bitsPerPixel == 32)
+				pixel = *(CARD32 *)src;
+			else
+				pixel = *(CARD16 *)src;
+		}
+		if (!GLAMOCompositeFill(op, pSrcPicture, pixel, &fill)) {
+			GLAMO_FALLBACK(GLAMO_FALLBACK_COMPOSITE,
+			               ("Translucent solid source\n"));
+		}
+		return GlamoKMSExaPrepareSolid(pDst, GXcopy, FB_ALLONES, fill);
+
+	default:
+		return FALSE;
+	}
 }
 
 
@@ -494,17 +1163,46 @@ void GlamoKMSExaComposite(PixmapPtr pDst,
                           int width,
                           int height)
 {
+	ScrnInfoPtr pScrn = xf86Screens[pDst->drawable.pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+
+	if (pGlamo->composite == GLAMO_COMPOSITE_COPY) {
+		GlamoKMSExaCopy(pDst, srcX, srcY, dstX, dstY, width, height);
+	} else {
+		GlamoKMSExaSolid(pDst, dstX, dstY,
+		                 dstX + width, dstY + height);
+	}
 }
 
 
 void GlamoKMSExaDoneComposite(PixmapPtr pDst)
 {
+	ScrnInfoPtr pScrn = xf86Screens[pDst->drawable.pScreen->myNum];
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+
+	if (pGlamo->composite == GLAMO_COMPOSITE_COPY)
+		GlamoKMSExaDoneCopy(pDst);
+	else
+		GlamoKMSExaDoneSolid(pDst);
 }
 
 
 void GlamoKMSExaClose(ScrnInfoPtr pScrn)
 {
+	GlamoPtr pGlamo = GlamoPTR(pScrn);
+	int i;
+
+	GLAMORenderFini(pScrn->pScreen);
 	exaDriverFini(pScrn->pScreen);
+	GlamoDRMFini(pGlamo);
+
+	for (i = 0; i < GLAMO_KMS_STAGING_SLOTS; i++) {
+		if (!pGlamo->staging_bo[i])
+			continue;
+		glamo_bo_unref(pGlamo->staging_bo[i]);
+		pGlamo->staging_bo[i] = NULL;
+		pGlamo->stats.bo_frees++;
+	}
 }
 
 
@@ -513,7 +1211,6 @@ void GlamoKMSExaInit(ScrnInfoPtr pScrn)
 	GlamoPtr pGlamo = GlamoPTR(pScrn);
 	Bool success = FALSE;
 	ExaDriverPtr exa;
-	int i;
 
 	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
 	           "EXA hardware acceleration initialising\n");
@@ -529,8 +1226,11 @@ void GlamoKMSExaInit(ScrnInfoPtr pScrn)
 	exa->offScreenBase = 0;
 	exa->pixmapOffsetAlign = 2;
 	exa->pixmapPitchAlign = 2;
-	exa->maxX = 640;
-	exa->maxY = 640;
+	/* The pitch limits the width.  The relocations can't carry an offset
+	 * into a buffer object, so unlike the fbdev path, operations can't be
+	 * split into bands and the height is limited by the coordinates. */
+	exa->maxX = (GLAMO_2D_MAX_PITCH + 1) / 2 - 1;
+	exa->maxY = GLAMO_2D_MAX_COORD;
 
 	/* Solid fills */
 	exa->PrepareSolid = GlamoKMSExaPrepareSolid;
@@ -548,21 +1248,18 @@ void GlamoKMSExaInit(ScrnInfoPtr pScrn)
 	exa->Composite = GlamoKMSExaComposite;
 	exa->DoneComposite = GlamoKMSExaDoneComposite;
 
-	exa->DownloadFromScreen = NULL;
-	exa->UploadToScreen = NULL;
+	exa->DownloadFromScreen = GlamoKMSExaDownloadFromScreen;
+	exa->UploadToScreen = GlamoKMSExaUploadToScreen;
 	exa->UploadToScratch = NULL;
 
 	exa->MarkSync = GlamoKMSExaMarkSync;
 	exa->WaitMarker = GlamoKMSExaWaitMarker;
 
 	/* Prepare temporary buffers */
-	GlamoDRMInit(pGlamo);
-	pGlamo->last_buffer_object = NULL;
-	for ( i=0; i<NUM_EXA_BUFFER_MARKERS; i++ ) {
-		pGlamo->exa_buffer_markers[i] = NULL;
-	}
-	pGlamo->exa_marker_index = 0;
+	GlamoDRMInit(pGlamo, xf86SetBoolOption(pScrn->options, "SubmitThread",
+	                                       FALSE));
 	if ( !pGlamo->cmdq_drm ) return;
+	pGlamo->peephole = xf86SetBoolOption(pScrn->options, "Peephole", FALSE);
 
 	/* Tell EXA that we're going to take care of memory
 	 * management ourselves. */
@@ -585,6 +1282,7 @@ void GlamoKMSExaInit(ScrnInfoPtr pScrn)
 	if (success) {
 		xf86DrvMsg(pScrn->scrnIndex, X_INFO,
 			"Initialized EXA acceleration\n");
+		GLAMORenderInit(pScrn->pScreen);
 	} else {
 		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
 			"Failed to initialize EXA acceleration\n");
@@ -24,6 +24,28 @@
 
 struct glamo_exa_pixmap_priv {
 	struct glamo_bo *bo;
+	/* Fences of the last submissions which read from and wrote to the
+	 * pixmap (see glamo-drm.c) */
+	unsigned int read_seq;
+	unsigned int write_seq;
+	/* Named for DRI2, so clients may render to it too */
+	Bool exported;
+	/* Allocated for the screen pixmap, and always accessed in place.
+	 * This goes with bo when page flips exchange buffer objects. */
+	Bool pinned;
+	/* Placement: the balance of accelerated operations against CPU
+	 * accesses, and whether the CPU uses EXA's system memory copy */
+	int usage;
+	Bool prefer_sys;
+	/* Mapped for the CPU between PrepareAccess and FinishAccess */
+	Bool mapped;
+	/* Size of the pixmap's memory, and its contents while evicted from
+	 * video memory, when bo is NULL */
+	int size;
+	void *sys_backing;
+	/* Pixmaps in video memory, most recently used first */
+	struct glamo_exa_pixmap_priv *lru_prev;
+	struct glamo_exa_pixmap_priv *lru_next;
 };
 
 extern void GlamoKMSExaInit(ScrnInfoPtr pScrn);
@@ -32,3 +54,7 @@ extern unsigned int driGetPixmapHandle(PixmapPtr pPixmap, unsigned int *flags);
 extern Bool GlamoKMSExaMakeFullyFledged(PixmapPtr pPix, int width, int height,
                                         int depth, int bitsPerPixel,
                                         int devKind);
+extern Bool GlamoKMSExaExportPixmap(PixmapPtr pPix);
+extern void GlamoKMSExaExchangeBOs(PixmapPtr pA, PixmapPtr pB);
+extern Bool GlamoKMSExaCopyBoxes(PixmapPtr pSrc, PixmapPtr pDst, BoxPtr boxes,
+                                 int nbox, int src_dx, int src_dy);
@@ -0,0 +1,547 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+
+/*
+ * An optional pass over each batch of 2D commands before it is submitted
+ * (Option "Peephole").  The batch is decoded into the blits it starts, each
+ * with the register state it runs with.  Then
+ *
+ *  - blits whose destination a later opaque blit covers are dropped, unless
+ *    something in between reads it,
+ *  - blits are moved up behind an earlier one with the same state, past the
+ *    blits whose memory they don't touch,
+ *  - fills of adjacent rectangles with the same state are merged,
+ *
+ * and the commands are written out again, each register only where its
+ * value changes, followed by the state the batch left behind.  Batches
+ * writing anything but the 2D registers the driver uses, or with blits
+ * depending on state from an earlier batch, are left as they are.
+ *
+ * With relocations (DRM), addresses are only known relative to their
+ * buffer objects, so the handle of the object is kept in the top half of
+ * the 64 bit addresses used below.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "glamo.h"
+#include "glamo-regs.h"
+#include "glamo-peephole.h"
+
+/* How many blits are searched for one covering or matching another */
+#define PP_WINDOW 32
+
+#define PP_REG(reg)	(((reg) - GLAMO_REG_2D_SRC_ADDRL) >> 1)
+#define PP_NREGS	(PP_REG(GLAMO_REG_2D_ID2) + 1)
+#define PP_BIT(reg)	((uint64_t)1 << PP_REG(reg))
+
+#define PP_SRC_REGS	(PP_BIT(GLAMO_REG_2D_SRC_ADDRL) |		\
+			 PP_BIT(GLAMO_REG_2D_SRC_ADDRH) |		\
+			 PP_BIT(GLAMO_REG_2D_SRC_PITCH) |		\
+			 PP_BIT(GLAMO_REG_2D_SRC_X) |			\
+			 PP_BIT(GLAMO_REG_2D_SRC_Y))
+#define PP_DST_REGS	(PP_BIT(GLAMO_REG_2D_DST_ADDRL) |		\
+			 PP_BIT(GLAMO_REG_2D_DST_ADDRH) |		\
+			 PP_BIT(GLAMO_REG_2D_DST_PITCH) |		\
+			 PP_BIT(GLAMO_REG_2D_DST_HEIGHT) |		\
+			 PP_BIT(GLAMO_REG_2D_DST_X) |			\
+			 PP_BIT(GLAMO_REG_2D_DST_Y) |			\
+			 PP_BIT(GLAMO_REG_2D_RECT_WIDTH) |		\
+			 PP_BIT(GLAMO_REG_2D_RECT_HEIGHT) |		\
+			 PP_BIT(GLAMO_REG_2D_COMMAND2) |		\
+			 PP_BIT(GLAMO_REG_2D_ID1) |			\
+			 PP_BIT(GLAMO_REG_2D_ID2))
+
+/* The registers the driver writes, besides GLAMO_REG_2D_COMMAND3 */
+#define PP_STATE_REGS	(PP_SRC_REGS | PP_DST_REGS |			\
+			 PP_BIT(GLAMO_REG_2D_PAT_FG))
+
+/* The rectangle, which may differ between blits that are otherwise alike */
+#define PP_GEOMETRY_REGS (PP_BIT(GLAMO_REG_2D_SRC_X) |			\
+			  PP_BIT(GLAMO_REG_2D_SRC_Y) |			\
+			  PP_BIT(GLAMO_REG_2D_DST_X) |			\
+			  PP_BIT(GLAMO_REG_2D_DST_Y) |			\
+			  PP_BIT(GLAMO_REG_2D_RECT_WIDTH) |		\
+			  PP_BIT(GLAMO_REG_2D_RECT_HEIGHT))
+
+#define REGS(b, reg)	((b)->state.regs[PP_REG(GLAMO_REG_2D_ ## reg)])
+
+enum { PP_SRC, PP_DST };
+
+struct pp_state {
+    CARD16 regs[PP_NREGS];
+    uint64_t known;		/* PP_BIT()s of the registers written */
+    int reloc[2];		/* of SRC_ADDRL and DST_ADDRL, or -1 */
+};
+
+struct pp_blit {
+    struct pp_state state;
+    CARD16 command3;
+    Bool uses_src;
+    Bool uses_dst;
+    /* The memory read from the source, and written */
+    uint64_t src_start, src_end;
+    uint64_t dst_start, dst_end;
+    int prev, next;
+};
+
+/* Scratch space, grown to the largest batch seen */
+static struct pp_blit *pp_blits;
+static CARD16 *pp_cmds;
+static unsigned int *pp_obj_pos;
+static int *pp_map;
+static int pp_size;
+
+static Bool
+PPReserve(int count)
+{
+    struct pp_blit *blits;
+    CARD16 *cmds;
+    unsigned int *obj_pos;
+    int *map;
+
+    if (count <= pp_size)
+        return TRUE;
+
+    /* A blit takes a register write, and a relocation two */
+    blits = realloc(pp_blits, (count / 2) * sizeof(*blits));
+    if (blits)
+        pp_blits = blits;
+    cmds = realloc(pp_cmds, count * sizeof(*cmds));
+    if (cmds)
+        pp_cmds = cmds;
+    obj_pos = realloc(pp_obj_pos, (count / 4) * sizeof(*obj_pos));
+    if (obj_pos)
+        pp_obj_pos = obj_pos;
+    map = realloc(pp_map, (count / 4) * sizeof(*map));
+    if (map)
+        pp_map = map;
+
+    if (!blits || !cmds || !obj_pos || !map)
+        return FALSE;
+
+    pp_size = count;
+    return TRUE;
+}
+
+void
+GlamoPeepholeFini(void)
+{
+    free(pp_blits);
+    free(pp_cmds);
+    free(pp_obj_pos);
+    free(pp_map);
+    pp_blits = NULL;
+    pp_cmds = NULL;
+    pp_obj_pos = NULL;
+    pp_map = NULL;
+    pp_size = 0;
+}
+
+static uint64_t
+PPHandle(const struct pp_state *s, const uint32_t *handles, int which)
+{
+    if (s->reloc[which] < 0)
+        return 0;
+    return ((uint64_t)handles[s->reloc[which]] + 1) << 32;
+}
+
+/* The bytes of a surface which a rectangle on it spans */
+static void
+PPExtent(const struct pp_blit *b, uint64_t addr, CARD16 pitch,
+         CARD16 x, CARD16 y, uint64_t *start, uint64_t *end)
+{
+    CARD16 w = REGS(b, RECT_WIDTH), h = REGS(b, RECT_HEIGHT);
+
+    *start = *end = addr + (uint64_t)y * pitch + x * 2;
+    if (w && h)
+        *end += (uint64_t)(h - 1) * pitch + w * 2;
+}
+
+static Bool
+PPOverlap(uint64_t start1, uint64_t end1, uint64_t start2, uint64_t end2)
+{
+    return start1 < end2 && start2 < end1;
+}
+
+/* Whether two blits touch the same memory, other than both reading it */
+static Bool
+PPConflict(const struct pp_blit *a, const struct pp_blit *b)
+{
+    return PPOverlap(a->dst_start, a->dst_end, b->dst_start, b->dst_end) ||
+           (a->uses_src && PPOverlap(a->src_start, a->src_end,
+                                     b->dst_start, b->dst_end)) ||
+           (b->uses_src && PPOverlap(b->src_start, b->src_end,
+                                     a->dst_start, a->dst_end));
+}
+
+/* Whether a blit reads what another one writes */
+static Bool
+PPReads(const struct pp_blit *b, const struct pp_blit *from)
+{
+    return (b->uses_dst && PPOverlap(b->dst_start, b->dst_end,
+                                     from->dst_start, from->dst_end)) ||
+           (b->uses_src && PPOverlap(b->src_start, b->src_end,
+                                     from->dst_start, from->dst_end));
+}
+
+/* Whether an opaque blit overwrites everything another one writes.  The
+ * rows of the destination are limited by its height register. */
+static Bool
+PPCovers(const struct pp_blit *b, const struct pp_blit *a)
+{
+    CARD16 pitch = REGS(b, DST_PITCH) & 0x7ff;
+    int b_rows = REGS(b, RECT_HEIGHT), a_rows = REGS(a, RECT_HEIGHT);
+    int b_bytes = REGS(b, RECT_WIDTH) * 2, a_bytes = REGS(a, RECT_WIDTH) * 2;
+    uint64_t b_row, a_row, b_col, a_col;
+
+    if (b->uses_dst || !pitch || pitch != (REGS(a, DST_PITCH) & 0x7ff))
+        return FALSE;
+    if (b->dst_start == b->dst_end || a->dst_start == a->dst_end)
+        return FALSE;
+
+    if (REGS(b, DST_Y) + b_rows > REGS(b, DST_HEIGHT))
+        b_rows = REGS(b, DST_HEIGHT) - REGS(b, DST_Y);
+
+    b_row = b->dst_start / pitch;
+    b_col = b->dst_start % pitch;
+    a_row = a->dst_start / pitch;
+    a_col = a->dst_start % pitch;
+
+    /* Rectangles running past the end of a row don't stay rectangles */
+    if (b_col + b_bytes > pitch || a_col + a_bytes > pitch)
+        return FALSE;
+
+    return b_rows > 0 &&
+           a_row >= b_row && a_row + a_rows <= b_row + b_rows &&
+           a_col >= b_col && a_col + a_bytes <= b_col + b_bytes;
+}
+
+/* Whether two blits differ in nothing but their rectangles */
+static Bool
+PPSameState(const struct pp_blit *a, const struct pp_blit *b,
+            const uint32_t *handles)
+{
+    uint64_t known = a->state.known & ~PP_GEOMETRY_REGS;
+    int i;
+
+    if (a->command3 != b->command3 ||
+        known != (b->state.known & ~PP_GEOMETRY_REGS))
+        return FALSE;
+
+    for (i = 0; i < PP_NREGS; i++) {
+        if ((known & ((uint64_t)1 << i)) &&
+            a->state.regs[i] != b->state.regs[i])
+            return FALSE;
+    }
+
+    return PPHandle(&a->state, handles, PP_SRC) ==
+               PPHandle(&b->state, handles, PP_SRC) &&
+           PPHandle(&a->state, handles, PP_DST) ==
+               PPHandle(&b->state, handles, PP_DST);
+}
+
+static void
+PPSetExtents(struct pp_blit *b, const uint32_t *handles)
+{
+    uint64_t addr;
+
+    if (b->uses_src) {
+        addr = REGS(b, SRC_ADDRL) | (REGS(b, SRC_ADDRH) & 0x7f) << 16;
+        PPExtent(b, addr | PPHandle(&b->state, handles, PP_SRC),
+                 REGS(b, SRC_PITCH) & 0x7ff, REGS(b, SRC_X), REGS(b, SRC_Y),
+                 &b->src_start, &b->src_end);
+    }
+
+    addr = REGS(b, DST_ADDRL) | (REGS(b, DST_ADDRH) & 0x7f) << 16;
+    PPExtent(b, addr | PPHandle(&b->state, handles, PP_DST),
+             REGS(b, DST_PITCH) & 0x7ff, REGS(b, DST_X), REGS(b, DST_Y),
+             &b->dst_start, &b->dst_end);
+}
+
+/* Make a fill also do the next one, if that fills the rectangle beside or
+ * below it the same way */
+static Bool
+PPMerge(struct pp_blit *a, const struct pp_blit *b, const uint32_t *handles)
+{
+    CARD16 ax = REGS(a, DST_X), ay = REGS(a, DST_Y);
+    CARD16 aw = REGS(a, RECT_WIDTH), ah = REGS(a, RECT_HEIGHT);
+    CARD16 bx = REGS(b, DST_X), by = REGS(b, DST_Y);
+    CARD16 bw = REGS(b, RECT_WIDTH), bh = REGS(b, RECT_HEIGHT);
+
+    if (a->uses_src || b->uses_src || !aw || !ah || !bw || !bh ||
+        !PPSameState(a, b, handles))
+        return FALSE;
+
+    if (ax == bx && aw == bw && by == ay + ah &&
+        ah + bh <= GLAMO_2D_MAX_COORD)
+        REGS(a, RECT_HEIGHT) = ah + bh;
+    else if (ay == by && ah == bh && bx == ax + aw &&
+             aw + bw <= GLAMO_2D_MAX_COORD)
+        REGS(a, RECT_WIDTH) = aw + bw;
+    else
+        return FALSE;
+
+    PPSetExtents(a, handles);
+    return TRUE;
+}
+
+static void
+PPUnlink(int *head, int i)
+{
+    struct pp_blit *b = &pp_blits[i];
+
+    if (b->prev != -1)
+        pp_blits[b->prev].next = b->next;
+    else
+        *head = b->next;
+    if (b->next != -1)
+        pp_blits[b->next].prev = b->prev;
+}
+
+static void
+PPInsertAfter(int after, int i)
+{
+    struct pp_blit *b = &pp_blits[i];
+
+    b->prev = after;
+    b->next = pp_blits[after].next;
+    if (b->next != -1)
+        pp_blits[b->next].prev = i;
+    pp_blits[after].next = i;
+}
+
+/* Write the registers of a state which differ from those written so far.
+ * Returns FALSE if the commands don't fit in max halfwords. */
+static Bool
+PPEmitState(struct pp_state *out, const struct pp_state *s,
+            const uint32_t *handles, int *count, int max, int *nrelocs)
+{
+    CARD16 reg;
+    int i, which;
+
+    for (i = 0; i < PP_NREGS; i++) {
+        if (!(s->known & ((uint64_t)1 << i)))
+            continue;
+        reg = GLAMO_REG_2D_SRC_ADDRL + 2 * i;
+
+        /* Addresses go together, as their relocations patch both */
+        if ((reg == GLAMO_REG_2D_SRC_ADDRL || reg == GLAMO_REG_2D_DST_ADDRL)
+            && (s->known & ((uint64_t)1 << (i + 1)))) {
+            which = reg == GLAMO_REG_2D_SRC_ADDRL ? PP_SRC : PP_DST;
+            if ((out->known & ((uint64_t)3 << i)) == ((uint64_t)3 << i) &&
+                out->regs[i] == s->regs[i] &&
+                out->regs[i + 1] == s->regs[i + 1] &&
+                PPHandle(out, handles, which) == PPHandle(s, handles, which)) {
+                i++;
+                continue;
+            }
+            if (*count + 4 > max)
+                return FALSE;
+            if (s->reloc[which] >= 0) {
+                pp_obj_pos[*nrelocs] = *count * 2;
+                pp_map[*nrelocs] = s->reloc[which];
+                (*nrelocs)++;
+            }
+            pp_cmds[(*count)++] = reg;
+            pp_cmds[(*count)++] = s->regs[i];
+            pp_cmds[(*count)++] = reg + 2;
+            pp_cmds[(*count)++] = s->regs[i + 1];
+            out->regs[i] = s->regs[i];
+            out->regs[i + 1] = s->regs[i + 1];
+            out->known |= (uint64_t)3 << i;
+            out->reloc[which] = s->reloc[which];
+            i++;
+            continue;
+        }
+
+        if ((out->known & ((uint64_t)1 << i)) && out->regs[i] == s->regs[i])
+            continue;
+        if (*count + 2 > max)
+            return FALSE;
+        pp_cmds[(*count)++] = reg;
+        pp_cmds[(*count)++] = s->regs[i];
+        out->regs[i] = s->regs[i];
+        out->known |= (uint64_t)1 << i;
+    }
+
+    return TRUE;
+}
+
+/* Optimise the count halfwords of commands at cmds in place.  The
+ * *nrelocs relocations (DRM only) are of the buffer objects handles[i], at
+ * the byte offsets obj_pos[i].  Returns the new count; if that is smaller,
+ * obj_pos and *nrelocs give the relocations of the new commands, which are
+ * those of handles[reloc_map[i]]. */
+int
+GlamoPeepholeRun(GlamoPtr pGlamo, uint16_t *cmds, int count,
+                 const uint32_t *handles, unsigned int *obj_pos,
+                 int *nrelocs, int *reloc_map)
+{
+    struct pp_state shadow, out;
+    struct pp_blit *b;
+    uint64_t need;
+    unsigned long dropped = 0, moved = 0, merged = 0;
+    CARD16 reg, val;
+    CARD8 rop;
+    int nblits = 0, reloc = 0, nout = 0, used = 0;
+    int head, i, j, n, next;
+
+    if (count < 4 || (count & 1) || !PPReserve(count))
+        return count;
+
+    memset(&shadow, 0, sizeof(shadow));
+    shadow.reloc[PP_SRC] = shadow.reloc[PP_DST] = -1;
+
+    /* Decode the blits, and the state each runs with */
+    for (i = 0; i < count; i += 2) {
+        reg = cmds[i];
+        val = cmds[i + 1];
+
+        if (reg == GLAMO_REG_2D_COMMAND3) {
+            b = &pp_blits[nblits];
+            b->state = shadow;
+            b->command3 = val;
+
+            rop = REGS(b, COMMAND2) >> 8;
+            b->uses_src = ROP3_USES_SRC(rop) != 0;
+            b->uses_dst = ROP3_USES_DST(rop) != 0;
+            need = PP_DST_REGS;
+            if (b->uses_src)
+                need |= PP_SRC_REGS;
+            if (ROP3_USES_PAT(rop))
+                need |= PP_BIT(GLAMO_REG_2D_PAT_FG);
+            if ((shadow.known & need) != need)
+                return count;
+
+            PPSetExtents(b, handles);
+            b->prev = nblits - 1;
+            b->next = nblits + 1;
+            nblits++;
+            continue;
+        }
+
+        if (reg < GLAMO_REG_2D_SRC_ADDRL || reg > GLAMO_REG_2D_ID2 ||
+            (reg & 1) || !(PP_STATE_REGS & PP_BIT(reg)))
+            return count;
+
+        if (reloc < *nrelocs && obj_pos[reloc] == i * 2) {
+            if ((reg != GLAMO_REG_2D_SRC_ADDRL &&
+                 reg != GLAMO_REG_2D_DST_ADDRL) ||
+                i + 2 >= count || cmds[i + 2] != reg + 2)
+                return count;
+            if (reg == GLAMO_REG_2D_SRC_ADDRL)
+                shadow.reloc[PP_SRC] = reloc;
+            else
+                shadow.reloc[PP_DST] = reloc;
+            reloc++;
+        } else if (reg == GLAMO_REG_2D_SRC_ADDRL) {
+            shadow.reloc[PP_SRC] = -1;
+        } else if (reg == GLAMO_REG_2D_DST_ADDRL) {
+            shadow.reloc[PP_DST] = -1;
+        }
+
+        shadow.regs[PP_REG(reg)] = val;
+        shadow.known |= PP_BIT(reg);
+    }
+
+    if (!nblits || reloc != *nrelocs)
+        return count;
+    pp_blits[nblits - 1].next = -1;
+    head = 0;
+
+    /* Drop blits which a later one overwrites before anything reads them */
+    for (i = head; i != -1; i = next) {
+        next = pp_blits[i].next;
+        for (j = next, n = 0; j != -1 && n < PP_WINDOW;
+             j = pp_blits[j].next, n++) {
+            if (PPReads(&pp_blits[j], &pp_blits[i]))
+                break;
+            if (PPCovers(&pp_blits[j], &pp_blits[i])) {
+                PPUnlink(&head, i);
+                dropped++;
+                break;
+            }
+        }
+    }
+
+    /* Move blits up behind earlier ones with the same state */
+    for (j = head; j != -1; j = next) {
+        next = pp_blits[j].next;
+        for (i = pp_blits[j].prev, n = 0; i != -1 && n < PP_WINDOW;
+             i = pp_blits[i].prev, n++) {
+            if (PPSameState(&pp_blits[i], &pp_blits[j], handles)) {
+                if (i != pp_blits[j].prev) {
+                    PPUnlink(&head, j);
+                    PPInsertAfter(i, j);
+                    moved++;
+                }
+                break;
+            }
+            if (PPConflict(&pp_blits[i], &pp_blits[j]))
+                break;
+        }
+    }
+
+    /* Merge fills of neighbouring rectangles */
+    for (i = head; i != -1; ) {
+        next = pp_blits[i].next;
+        if (next != -1 && PPMerge(&pp_blits[i], &pp_blits[next], handles)) {
+            PPUnlink(&head, next);
+            merged++;
+            continue;
+        }
+        i = next;
+    }
+
+    /* Write the commands out again, then the state the batch ends with */
+    memset(&out, 0, sizeof(out));
+    out.reloc[PP_SRC] = out.reloc[PP_DST] = -1;
+    for (i = head; i != -1; i = pp_blits[i].next) {
+        if (!PPEmitState(&out, &pp_blits[i].state, handles, &used, count,
+                         &nout) || used + 2 > count)
+            return count;
+        pp_cmds[used++] = GLAMO_REG_2D_COMMAND3;
+        pp_cmds[used++] = pp_blits[i].command3;
+    }
+    if (!PPEmitState(&out, &shadow, handles, &used, count, &nout))
+        return count;
+
+    if (used >= count || nout > *nrelocs)
+        return count;
+
+    memcpy(cmds, pp_cmds, used * sizeof(*cmds));
+    if (nout) {
+        memcpy(obj_pos, pp_obj_pos, nout * sizeof(*obj_pos));
+        memcpy(reloc_map, pp_map, nout * sizeof(*reloc_map));
+    }
+    *nrelocs = nout;
+
+    pGlamo->stats.peephole_dropped += dropped;
+    pGlamo->stats.peephole_moved += moved;
+    pGlamo->stats.peephole_merged += merged;
+    pGlamo->stats.peephole_saved += (count - used) * 2;
+
+    return used;
+}
@@ -786,4 +786,10 @@ enum glamo_register_2d {
 	GLAMO_REG_2D_ID3		= REG_2D(0x48),
 };
 
+/* Whether a ternary raster operation, as in the top byte of
+ * GLAMO_REG_2D_COMMAND2, depends on the source / pattern / destination */
+#define ROP3_USES_SRC(rop) ((((rop) >> 2) ^ (rop)) & 0x33)
+#define ROP3_USES_PAT(rop) ((((rop) >> 4) ^ (rop)) & 0x0f)
+#define ROP3_USES_DST(rop) ((((rop) >> 1) ^ (rop)) & 0x55)
+
 #endif /* _GLAMO_REGS_H */
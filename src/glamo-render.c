@@ -0,0 +1,476 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Render operations which the 2D engine does exactly: PictOpSrc between
+ * pictures of the same 16 bit format is a blit, and PictOpClear, or
+ * PictOpSrc and PictOpOver from an opaque solid colour, are fills.
+ * Pictures without transforms, alpha maps or masks only.
+ *
+ * Blending itself is left to pixman: the only other engine on the chip
+ * which could do it is the 3D engine, whose registers aren't documented,
+ * so there is no 3D backend.  What is caught is blending a fully
+ * transparent solid colour, which toolkits do a lot and which doesn't
+ * change the destination at all.  That is dropped in a wrapper of
+ * Composite, before EXA would move the pictures into video memory for it.
+ *
+ * Anti-aliased shapes drawn with Trapezoids and Triangles in an opaque
+ * solid colour have their interiors filled by the 2D engine, through
+ * CompositeRects, and only the edges are left to software.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "glamo.h"
+#include "glamo-render.h"
+
+/* Smaller interiors aren't worth a trip through the 2D engine */
+#define GLAMO_SHAPE_MIN_FILL 256
+
+/* Whether a picture is one colour: a solid fill, or a 1x1 repeating
+ * pixmap in a format GLAMOCompositeFill() converts */
+static Bool
+GLAMOPictureIsSolid(PicturePtr pPict)
+{
+    if (!pPict->pDrawable)
+        return pPict->pSourcePict &&
+               pPict->pSourcePict->type == SourcePictTypeSolidFill;
+
+    if (pPict->pDrawable->width != 1 || pPict->pDrawable->height != 1 ||
+        !pPict->repeat || pPict->repeatType != RepeatNormal ||
+        pPict->transform)
+        return FALSE;
+
+    switch (pPict->format) {
+    case PICT_a8r8g8b8:
+    case PICT_x8r8g8b8:
+    case PICT_r5g6b5:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/* Whether compositing the source leaves the destination unchanged,
+ * whatever the mask: Over and Add from a solid fill of all zeroes.  Colours
+ * aren't checked to be premultiplied, so a transparent one with any colour
+ * in it would still be added. */
+static Bool
+GLAMOCompositeIsNoop(CARD8 op, PicturePtr pSrcPicture)
+{
+    if (op != PictOpOver && op != PictOpAdd)
+        return FALSE;
+    if (pSrcPicture->pDrawable || !pSrcPicture->pSourcePict ||
+        pSrcPicture->pSourcePict->type != SourcePictTypeSolidFill ||
+        pSrcPicture->alphaMap)
+        return FALSE;
+
+    return pSrcPicture->pSourcePict->solidFill.color == 0;
+}
+
+enum glamo_composite
+GLAMOCompositeCheck(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
+                    PicturePtr pDstPicture)
+{
+    if (pMaskPicture || pSrcPicture->alphaMap || pDstPicture->alphaMap)
+        return GLAMO_COMPOSITE_NONE;
+    if (!pDstPicture->pDrawable ||
+        pDstPicture->pDrawable->bitsPerPixel != 16)
+        return GLAMO_COMPOSITE_NONE;
+
+    if (op == PictOpClear)
+        return GLAMO_COMPOSITE_FILL;
+    if (op != PictOpSrc && op != PictOpOver)
+        return GLAMO_COMPOSITE_NONE;
+
+    /* Whether the colour is opaque enough for Over is only known when the
+     * pixel is read, in GLAMOCompositeFill() */
+    if (GLAMOPictureIsSolid(pSrcPicture))
+        return pDstPicture->format == PICT_r5g6b5 ? GLAMO_COMPOSITE_FILL
+                                                  : GLAMO_COMPOSITE_NONE;
+
+    /* Over from a source without alpha is the same as Src */
+    if (pSrcPicture->pDrawable && !pSrcPicture->transform &&
+        !pSrcPicture->repeat &&
+        pSrcPicture->format == pDstPicture->format &&
+        (op == PictOpSrc || !PICT_FORMAT_A(pSrcPicture->format)))
+        return GLAMO_COMPOSITE_COPY;
+
+    return GLAMO_COMPOSITE_NONE;
+}
+
+/* Work out the fill for a GLAMO_COMPOSITE_FILL operation in the 16 bit
+ * destination format, from the source's pixel as read from its 1x1
+ * pixmap, if it has one.  Returns FALSE if the colour is translucent and
+ * would have to be blended. */
+Bool
+GLAMOCompositeFill(int op, PicturePtr pSrcPicture, CARD32 pixel, Pixel *fill)
+{
+    CARD32 format;
+
+    if (op == PictOpClear) {
+        *fill = 0;
+        return TRUE;
+    }
+
+    if (pSrcPicture->pDrawable) {
+        format = pSrcPicture->format;
+    } else {
+        format = PICT_a8r8g8b8;
+        pixel = pSrcPicture->pSourcePict->solidFill.color;
+    }
+
+    switch (format) {
+    case PICT_r5g6b5:
+        *fill = pixel & 0xffff;
+        return TRUE;
+    case PICT_a8r8g8b8:
+        if (op == PictOpOver && (pixel >> 24) != 0xff)
+            return FALSE;
+        break;
+    case PICT_x8r8g8b8:
+        break;
+    default:
+        return FALSE;
+    }
+
+    /* Truncated, as pixman stores r5g6b5 */
+    *fill = ((pixel >> 8) & 0xf800) | ((pixel >> 5) & 0x07e0) |
+            ((pixel >> 3) & 0x001f);
+
+    return TRUE;
+}
+
+/* Where a line crosses a horizontal, rounded towards zero */
+static int64_t
+GLAMOLineX(const xLineFixed *line, xFixed y)
+{
+    return line->p1.x + ((int64_t)y - line->p1.y) *
+                        ((int64_t)line->p2.x - line->p1.x) /
+                        ((int64_t)line->p2.y - line->p1.y);
+}
+
+static void
+GLAMOVerticalLine(xLineFixed *line, int x, xFixed top, xFixed bottom)
+{
+    line->p1.x = line->p2.x = pixman_int_to_fixed(x);
+    line->p1.y = top;
+    line->p2.y = bottom;
+}
+
+/* Find a rectangle of whole pixels inside a trapezoid and within the
+ * destination, and cut the rest of the trapezoid into up to four pieces
+ * around it.  Render samples pixels at points which never lie on pixel
+ * boundaries, so the rectangle and the pieces together cover exactly the
+ * samples the trapezoid did.  The rectangle keeps a pixel clear of the
+ * sloping edges, so the pixels they cross are all left to fb, and where
+ * shapes meet, both sides of an edge are stepped by pixman alike. */
+static Bool
+GLAMOSplitTrapezoid(const xTrapezoid *trap, int width, int height,
+                    xRectangle *rect, xTrapezoid *rest, int *nrest)
+{
+    int64_t left, right;
+    xFixed top, bottom;
+    int x1, y1, x2, y2;
+    int n = 0;
+
+    if (trap->left.p1.y == trap->left.p2.y ||
+        trap->right.p1.y == trap->right.p2.y)
+        return FALSE;
+
+    y1 = ((int64_t)trap->top + pixman_fixed_1 - pixman_fixed_e) >> 16;
+    y2 = trap->bottom >> 16;
+    if (y1 < 0)
+        y1 = 0;
+    if (y2 > height)
+        y2 = height;
+    if (y2 <= y1)
+        return FALSE;
+    top = pixman_int_to_fixed(y1);
+    bottom = pixman_int_to_fixed(y2);
+
+    /* The edges are straight, so they come furthest in at one end of the
+     * band or the other.  The pixel margin covers the rounding of
+     * GLAMOLineX(). */
+    left = GLAMOLineX(&trap->left, top);
+    if (GLAMOLineX(&trap->left, bottom) > left)
+        left = GLAMOLineX(&trap->left, bottom);
+    right = GLAMOLineX(&trap->right, top);
+    if (GLAMOLineX(&trap->right, bottom) < right)
+        right = GLAMOLineX(&trap->right, bottom);
+
+    if (left < 0)
+        x1 = 0;
+    else if (left >= pixman_int_to_fixed(width))
+        x1 = width;
+    else
+        x1 = (left >> 16) + 2;
+    if (right < 0)
+        x2 = 0;
+    else if (right >= pixman_int_to_fixed(width))
+        x2 = width;
+    else
+        x2 = (right >> 16) - 1;
+    if (x2 <= x1 || (x2 - x1) * (y2 - y1) < GLAMO_SHAPE_MIN_FILL)
+        return FALSE;
+
+    rect->x = x1;
+    rect->y = y1;
+    rect->width = x2 - x1;
+    rect->height = y2 - y1;
+
+    if (trap->top < top) {
+        rest[n] = *trap;
+        rest[n++].bottom = top;
+    }
+    if (bottom < trap->bottom) {
+        rest[n] = *trap;
+        rest[n++].top = bottom;
+    }
+    rest[n] = *trap;
+    rest[n].top = top;
+    rest[n].bottom = bottom;
+    GLAMOVerticalLine(&rest[n++].right, x1, top, bottom);
+    rest[n] = *trap;
+    rest[n].top = top;
+    rest[n].bottom = bottom;
+    GLAMOVerticalLine(&rest[n++].left, x2, top, bottom);
+
+    *nrest = n;
+    return TRUE;
+}
+
+/* Whether a shape is drawn in one opaque colour, through a single mask */
+static Bool
+GLAMOShapeIsSolid(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+                  PictFormatPtr maskFormat)
+{
+    if (op != PictOpOver || !maskFormat)
+        return FALSE;
+    if (pSrc->pDrawable || !pSrc->pSourcePict ||
+        pSrc->pSourcePict->type != SourcePictTypeSolidFill ||
+        pSrc->alphaMap || pDst->alphaMap)
+        return FALSE;
+
+    return (pSrc->pSourcePict->solidFill.color >> 24) == 0xff;
+}
+
+static void
+GLAMOShapes(GlamoPtr pGlamo, CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+            PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+            int ntrap, xTrapezoid *traps)
+{
+    PictureScreenPtr ps = GetPictureScreen(pDst->pDrawable->pScreen);
+    CARD32 pixel = pSrc->pSourcePict->solidFill.color;
+    xRenderColor color;
+    xRectangle *rects;
+    xTrapezoid *rest;
+    int nrects = 0, nrest = 0;
+    int i, n;
+
+    rects = malloc(ntrap * sizeof(xRectangle));
+    rest = malloc(ntrap * 4 * sizeof(xTrapezoid));
+    if (!rects || !rest) {
+        free(rects);
+        free(rest);
+        pGlamo->Trapezoids(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+                           ntrap, traps);
+        return;
+    }
+
+    for (i = 0; i < ntrap; i++) {
+        if (GLAMOSplitTrapezoid(&traps[i], pDst->pDrawable->width,
+                                pDst->pDrawable->height,
+                                &rects[nrects], &rest[nrest], &n)) {
+            nrects++;
+            nrest += n;
+        } else {
+            rest[nrest++] = traps[i];
+        }
+    }
+
+    /* Fully covered pixels come out as the source colour, whatever else
+     * the mask holds for them */
+    if (nrects) {
+        color.red = ((pixel >> 16) & 0xff) * 0x101;
+        color.green = ((pixel >> 8) & 0xff) * 0x101;
+        color.blue = (pixel & 0xff) * 0x101;
+        color.alpha = 0xffff;
+        ps->CompositeRects(PictOpSrc, pDst, &color, nrects, rects);
+        pGlamo->stats.shape_fills += nrects;
+    }
+
+    /* The edges must still go through one mask, where they meet */
+    if (nrest)
+        pGlamo->Trapezoids(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+                           nrest, rest);
+
+    free(rects);
+    free(rest);
+}
+
+static void
+GLAMOTrapezoids(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+                PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+                int ntrap, xTrapezoid *traps)
+{
+    ScreenPtr pScreen = pDst->pDrawable->pScreen;
+    GlamoPtr pGlamo = GlamoPTR(xf86Screens[pScreen->myNum]);
+
+    if (!GLAMOShapeIsSolid(op, pSrc, pDst, maskFormat)) {
+        pGlamo->Trapezoids(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+                           ntrap, traps);
+        return;
+    }
+
+    GLAMOShapes(pGlamo, op, pSrc, pDst, maskFormat, xSrc, ySrc,
+                ntrap, traps);
+}
+
+/* Cut a triangle at its middle vertex into up to two trapezoids, as
+ * pixman does to rasterise it */
+static int
+GLAMOTriangleToTrapezoids(const xTriangle *tri, xTrapezoid *traps)
+{
+    const xPointFixed *top = &tri->p1, *mid = &tri->p2, *bot = &tri->p3;
+    const xPointFixed *tmp;
+    xLineFixed edge, upper, lower;
+    int64_t side;
+    int n = 0;
+
+    if (mid->y < top->y) {
+        tmp = top; top = mid; mid = tmp;
+    }
+    if (bot->y < mid->y) {
+        tmp = mid; mid = bot; bot = tmp;
+    }
+    if (mid->y < top->y) {
+        tmp = top; top = mid; mid = tmp;
+    }
+    if (top->y == bot->y)
+        return 0;
+
+    edge.p1 = *top;
+    edge.p2 = *bot;
+    upper.p1 = *top;
+    upper.p2 = *mid;
+    lower.p1 = *mid;
+    lower.p2 = *bot;
+
+    /* Negative when the middle vertex is left of the long edge */
+    side = ((int64_t)mid->x - top->x) * ((int64_t)bot->y - top->y) -
+           ((int64_t)bot->x - top->x) * ((int64_t)mid->y - top->y);
+
+    if (top->y < mid->y) {
+        traps[n].top = top->y;
+        traps[n].bottom = mid->y;
+        traps[n].left = side < 0 ? upper : edge;
+        traps[n++].right = side < 0 ? edge : upper;
+    }
+    if (mid->y < bot->y) {
+        traps[n].top = mid->y;
+        traps[n].bottom = bot->y;
+        traps[n].left = side < 0 ? lower : edge;
+        traps[n++].right = side < 0 ? edge : lower;
+    }
+
+    return n;
+}
+
+static void
+GLAMOTriangles(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+               PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+               int ntri, xTriangle *tris)
+{
+    ScreenPtr pScreen = pDst->pDrawable->pScreen;
+    GlamoPtr pGlamo = GlamoPTR(xf86Screens[pScreen->myNum]);
+    xTrapezoid *traps;
+    int i, ntrap = 0;
+
+    if (!GLAMOShapeIsSolid(op, pSrc, pDst, maskFormat) ||
+        !(traps = malloc(ntri * 2 * sizeof(xTrapezoid)))) {
+        pGlamo->Triangles(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+                          ntri, tris);
+        return;
+    }
+
+    for (i = 0; i < ntri; i++)
+        ntrap += GLAMOTriangleToTrapezoids(&tris[i], &traps[ntrap]);
+
+    if (ntrap)
+        GLAMOShapes(pGlamo, op, pSrc, pDst, maskFormat, xSrc, ySrc,
+                    ntrap, traps);
+
+    free(traps);
+}
+
+static void
+GLAMOComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
+               INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
+               INT16 xDst, INT16 yDst, CARD16 width, CARD16 height)
+{
+    ScreenPtr pScreen = pDst->pDrawable->pScreen;
+    GlamoPtr pGlamo = GlamoPTR(xf86Screens[pScreen->myNum]);
+
+    if (GLAMOCompositeIsNoop(op, pSrc)) {
+        pGlamo->stats.composite_noops++;
+        return;
+    }
+
+    pGlamo->Composite(op, pSrc, pMask, pDst, xSrc, ySrc, xMask, yMask,
+                      xDst, yDst, width, height);
+}
+
+void
+GLAMORenderInit(ScreenPtr pScreen)
+{
+    GlamoPtr pGlamo = GlamoPTR(xf86Screens[pScreen->myNum]);
+    PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+
+    if (!ps)
+        return;
+
+    pGlamo->Composite = ps->Composite;
+    ps->Composite = GLAMOComposite;
+    pGlamo->Trapezoids = ps->Trapezoids;
+    ps->Trapezoids = GLAMOTrapezoids;
+    pGlamo->Triangles = ps->Triangles;
+    ps->Triangles = GLAMOTriangles;
+}
+
+void
+GLAMORenderFini(ScreenPtr pScreen)
+{
+    GlamoPtr pGlamo = GlamoPTR(xf86Screens[pScreen->myNum]);
+    PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+
+    if (!ps || !pGlamo->Trapezoids)
+        return;
+
+    ps->Composite = pGlamo->Composite;
+    ps->Trapezoids = pGlamo->Trapezoids;
+    ps->Triangles = pGlamo->Triangles;
+    pGlamo->Composite = NULL;
+    pGlamo->Trapezoids = NULL;
+    pGlamo->Triangles = NULL;
+}
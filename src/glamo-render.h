@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef _GLAMO_RENDER_H_
+#define _GLAMO_RENDER_H_
+
+#include "glamo.h"
+
+/*
+ * The Render operations which the 2D engine does exactly, shared by the
+ * EXA code of both the framebuffer and the DRM paths.  Everything else
+ * falls back to software.
+ */
+
+enum glamo_composite {
+	GLAMO_COMPOSITE_NONE,
+	GLAMO_COMPOSITE_COPY,	/* a blit from the source */
+	GLAMO_COMPOSITE_FILL,	/* a fill with GLAMOCompositeFill() */
+};
+
+enum glamo_composite
+GLAMOCompositeCheck(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
+                    PicturePtr pDstPicture);
+
+Bool
+GLAMOCompositeFill(int op, PicturePtr pSrcPicture, CARD32 pixel,
+                   Pixel *fill);
+
+void
+GLAMORenderInit(ScreenPtr pScreen);
+
+void
+GLAMORenderFini(ScreenPtr pScreen);
+
+#endif /* _GLAMO_RENDER_H_ */
@@ -0,0 +1,271 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * A software model of the parts of the glamo the driver touches: the
+ * register file, the command queue and the 2D engine.  With Option
+ * "Simulate" the driver runs on top of it instead of the real registers, so
+ * the accelerated paths can be used on any framebuffer device.
+ *
+ * The command queue is executed synchronously whenever its write pointer is
+ * moved, so the engines always appear idle.  With sim_latency set, a batch
+ * is instead left pending, and the engines busy, for that many reads of
+ * the status register, to exercise the code which overlaps with them.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "glamo.h"
+#include "glamo-regs.h"
+#include "glamo-sim.h"
+
+#define GLAMO_SIM_REG_SIZE 0x2400
+
+/* CMDQ_STATUS with the command queue empty and all engines idle, and with
+ * commands queued for the 2D engine */
+#define GLAMO_SIM_STATUS_IDLE 0x0007
+#define GLAMO_SIM_STATUS_BUSY 0x0010
+
+static CARD16
+GLAMOSimRop3(CARD8 rop, CARD16 pat, CARD16 src, CARD16 dst)
+{
+    CARD16 result = 0;
+    int i;
+
+    /* Bit (P << 2 | S << 1 | D) of the ROP gives the result for that
+     * combination of pattern, source and destination bits */
+    for (i = 0; i < 8; i++) {
+        if (rop & (1 << i))
+            result |= ((i & 4) ? pat : ~pat) &
+                      ((i & 2) ? src : ~src) &
+                      ((i & 1) ? dst : ~dst);
+    }
+
+    return result;
+}
+
+static size_t
+GLAMOSimVRAMSize(GlamoPtr pGlamo)
+{
+    return pGlamo->fb_fix.smem_len - pGlamo->fboff;
+}
+
+/* Check that a rectangle of a surface lies inside video memory */
+static Bool
+GLAMOSimCheckRect(GlamoPtr pGlamo, CARD32 addr, CARD16 pitch,
+                  int x, int y, int w, int h)
+{
+    size_t end;
+
+    if (w <= 0 || h <= 0)
+        return FALSE;
+
+    end = addr + (size_t)(y + h - 1) * pitch + (size_t)(x + w) * 2;
+
+    return end <= GLAMOSimVRAMSize(pGlamo);
+}
+
+static void
+GLAMOSim2D(GlamoPtr pGlamo)
+{
+    volatile char *mmio = pGlamo->reg_base;
+    CARD32 src_addr, dst_addr;
+    CARD16 src_pitch, dst_pitch;
+    CARD16 pat, src = 0;
+    CARD16 *tmp = NULL;
+    CARD16 *d;
+    int src_x, src_y, dst_x, dst_y;
+    int w, h, x, y;
+    CARD8 rop;
+
+    rop = MMIO_IN16(mmio, GLAMO_REG_2D_COMMAND2) >> 8;
+    pat = MMIO_IN16(mmio, GLAMO_REG_2D_PAT_FG);
+
+    dst_addr = MMIO_IN16(mmio, GLAMO_REG_2D_DST_ADDRL);
+    dst_addr |= (MMIO_IN16(mmio, GLAMO_REG_2D_DST_ADDRH) & 0x7f) << 16;
+    dst_pitch = MMIO_IN16(mmio, GLAMO_REG_2D_DST_PITCH) & 0x7ff;
+    dst_x = MMIO_IN16(mmio, GLAMO_REG_2D_DST_X);
+    dst_y = MMIO_IN16(mmio, GLAMO_REG_2D_DST_Y);
+    w = MMIO_IN16(mmio, GLAMO_REG_2D_RECT_WIDTH);
+    h = MMIO_IN16(mmio, GLAMO_REG_2D_RECT_HEIGHT);
+
+    if (!GLAMOSimCheckRect(pGlamo, dst_addr, dst_pitch, dst_x, dst_y, w, h))
+        return;
+
+    /* Read the whole source first, so that overlapping blits come out as if
+     * the engine had picked the right direction */
+    if (ROP3_USES_SRC(rop)) {
+        src_addr = MMIO_IN16(mmio, GLAMO_REG_2D_SRC_ADDRL);
+        src_addr |= (MMIO_IN16(mmio, GLAMO_REG_2D_SRC_ADDRH) & 0x7f) << 16;
+        src_pitch = MMIO_IN16(mmio, GLAMO_REG_2D_SRC_PITCH) & 0x7ff;
+        src_x = MMIO_IN16(mmio, GLAMO_REG_2D_SRC_X);
+        src_y = MMIO_IN16(mmio, GLAMO_REG_2D_SRC_Y);
+
+        if (!GLAMOSimCheckRect(pGlamo, src_addr, src_pitch,
+                               src_x, src_y, w, h))
+            return;
+
+        tmp = malloc(w * h * 2);
+        if (!tmp)
+            return;
+        for (y = 0; y < h; y++) {
+            memcpy(tmp + y * w,
+                   pGlamo->fbstart + src_addr + (src_y + y) * src_pitch
+                       + src_x * 2,
+                   w * 2);
+        }
+    }
+
+    for (y = 0; y < h; y++) {
+        d = (CARD16 *)(pGlamo->fbstart + dst_addr + (dst_y + y) * dst_pitch)
+            + dst_x;
+        for (x = 0; x < w; x++) {
+            if (tmp)
+                src = tmp[y * w + x];
+            d[x] = GLAMOSimRop3(rop, pat, src, d[x]);
+        }
+    }
+
+    free(tmp);
+}
+
+static void
+GLAMOSimWriteReg(GlamoPtr pGlamo, CARD16 reg, CARD16 val)
+{
+    /* Register 0 is the chip id, and the padding the command queue code
+     * inserts looks like a write to it */
+    if (reg == 0 || reg >= GLAMO_SIM_REG_SIZE)
+        return;
+
+    MMIO_OUT16(pGlamo->reg_base, reg, val);
+
+    if (reg == GLAMO_REG_2D_COMMAND3)
+        GLAMOSim2D(pGlamo);
+}
+
+/* Execute everything between the read and write pointers of the command
+ * queue */
+static void
+GLAMOSimExecute(GlamoPtr pGlamo)
+{
+    volatile char *mmio = pGlamo->reg_base;
+    unsigned char *ring;
+    CARD32 base, len, read, write;
+    CARD16 reg, val;
+    int n;
+
+    base = MMIO_IN16(mmio, GLAMO_REG_CMDQ_BASE_ADDRL);
+    base |= (MMIO_IN16(mmio, GLAMO_REG_CMDQ_BASE_ADDRH) & 0x7f) << 16;
+    len = ((MMIO_IN16(mmio, GLAMO_REG_CMDQ_LEN) & 0x3ff) + 1) * 1024;
+    if (base + len > GLAMOSimVRAMSize(pGlamo))
+        return;
+    ring = pGlamo->fbstart + base;
+
+    read = MMIO_IN16(mmio, GLAMO_REG_CMDQ_READ_ADDRL);
+    read |= MMIO_IN16(mmio, GLAMO_REG_CMDQ_READ_ADDRH) << 16;
+    write = MMIO_IN16(mmio, GLAMO_REG_CMDQ_WRITE_ADDRL);
+    write |= MMIO_IN16(mmio, GLAMO_REG_CMDQ_WRITE_ADDRH) << 16;
+    read %= len;
+    write %= len;
+
+#define FETCH(v) do {                                   \
+        (v) = *(CARD16 *)(ring + read);                 \
+        read = (read + 2) % len;                        \
+    } while (0)
+
+    while (read != write) {
+        FETCH(reg);
+        if (read == write)
+            break;
+        FETCH(val);
+        if (reg & (1 << 15)) {
+            /* Burst: val registers follow, starting at reg */
+            reg &= 0x7fff;
+            for (n = val; n > 0 && read != write; n--) {
+                FETCH(val);
+                GLAMOSimWriteReg(pGlamo, reg, val);
+                reg += 2;
+            }
+        } else {
+            GLAMOSimWriteReg(pGlamo, reg, val);
+        }
+    }
+
+#undef FETCH
+
+    MMIO_OUT16(mmio, GLAMO_REG_CMDQ_READ_ADDRH, (read >> 16) & 0xffff);
+    MMIO_OUT16(mmio, GLAMO_REG_CMDQ_READ_ADDRL, read & 0xffff);
+    MMIO_OUT16(mmio, GLAMO_REG_CMDQ_STATUS, GLAMO_SIM_STATUS_IDLE);
+}
+
+/* The write pointer of the command queue has moved */
+void
+GLAMOSimRun(GlamoPtr pGlamo)
+{
+    if (!pGlamo->sim_latency) {
+        GLAMOSimExecute(pGlamo);
+        return;
+    }
+
+    pGlamo->sim_pending = pGlamo->sim_latency;
+    MMIO_OUT16(pGlamo->reg_base, GLAMO_REG_CMDQ_STATUS,
+               GLAMO_SIM_STATUS_BUSY);
+}
+
+/* The status register is about to be read */
+void
+GLAMOSimPoll(GlamoPtr pGlamo)
+{
+    if (pGlamo->sim_pending && !--pGlamo->sim_pending)
+        GLAMOSimExecute(pGlamo);
+}
+
+Bool
+GLAMOSimInit(ScrnInfoPtr pScrn)
+{
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+
+    pGlamo->reg_base = calloc(1, GLAMO_SIM_REG_SIZE);
+    if (!pGlamo->reg_base) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                   "Failed to allocate simulated registers\n");
+        return FALSE;
+    }
+
+    MMIO_OUT16(pGlamo->reg_base, GLAMO_REG_CMDQ_STATUS,
+               GLAMO_SIM_STATUS_IDLE);
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Using simulated glamo registers and 2D engine\n");
+
+    return TRUE;
+}
+
+void
+GLAMOSimFini(ScrnInfoPtr pScrn)
+{
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+
+    free((void *)pGlamo->reg_base);
+    pGlamo->reg_base = NULL;
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Acceleration and fallback counters.  The counting itself is done inline
+ * where things happen; this file only reports them.  The current values
+ * are kept in the _GLAMO_STATS property of the root window, as text which
+ * "xprop -root _GLAMO_STATS" shows, and written to the log when the screen
+ * is closed.  The property is brought up to date before the server sleeps,
+ * at most once a second, and without PropertyNotify events, so that
+ * clients watching the root window aren't woken for it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <X11/Xatom.h>
+
+#include "os.h"
+#include "windowstr.h"
+#include "property.h"
+
+#include "glamo.h"
+#include "glamo-stats.h"
+#include "glamo-timing.h"
+
+#define GLAMO_STATS_PROPERTY	"_GLAMO_STATS"
+#define GLAMO_STATS_INTERVAL	1000	/* ms between updates */
+
+static void
+GlamoStatsPublish(ScrnInfoPtr pScrn)
+{
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+    struct glamo_stats *stats = &pGlamo->stats;
+    ScreenPtr pScreen = pScrn->pScreen;
+    WindowPtr pRoot;
+    Atom name;
+    char text[1024];
+    int len;
+
+#if XORG_VERSION_CURRENT >= XORG_VERSION_NUMERIC(1,9,99,1,0)
+    pRoot = pScreen->root;
+#else
+    pRoot = WindowTable[pScreen->myNum];
+#endif
+    if (!pRoot)
+        return;
+
+    len = snprintf(text, sizeof(text),
+                   "solid %lu\ncopy %lu\nupload %lu\nstaged_upload %lu\n"
+                   "download %lu\ncpu_access %lu\n"
+                   "fallback_bpp %lu\nfallback_planemask %lu\n"
+                   "fallback_size %lu\nfallback_composite %lu\n"
+                   "fallback_vram %lu\n"
+                   "submissions %lu\nbytes_submitted %llu\n"
+                   "ring_full_waits %lu\n"
+                   "flushes_idle %lu\nflushes_starved %lu\n"
+                   "flushes_full %lu\nflushes_deferred %lu\n"
+                   "engine_waits %lu\nengine_wait_usec %llu\n"
+                   "bo_allocs %lu\nbo_frees %lu\n"
+                   "evictions %lu\nrestores %lu\n"
+                   "placed_sys %lu\nplaced_vram %lu\n"
+                   "shape_fills %lu\ncomposite_noops %lu\n"
+                   "peephole_dropped %lu\npeephole_moved %lu\n"
+                   "peephole_merged %lu\npeephole_saved %llu\n",
+                   stats->ops[GLAMO_STAT_SOLID],
+                   stats->ops[GLAMO_STAT_COPY],
+                   stats->ops[GLAMO_STAT_UPLOAD],
+                   stats->ops[GLAMO_STAT_STAGED_UPLOAD],
+                   stats->ops[GLAMO_STAT_DOWNLOAD],
+                   stats->ops[GLAMO_STAT_CPU_ACCESS],
+                   stats->fallbacks[GLAMO_FALLBACK_BPP],
+                   stats->fallbacks[GLAMO_FALLBACK_PLANEMASK],
+                   stats->fallbacks[GLAMO_FALLBACK_SIZE],
+                   stats->fallbacks[GLAMO_FALLBACK_COMPOSITE],
+                   stats->fallbacks[GLAMO_FALLBACK_VRAM],
+                   stats->submissions, stats->bytes_submitted,
+                   stats->ring_full_waits,
+                   stats->flushes_idle, stats->flushes_starved,
+                   stats->flushes_full, stats->flushes_deferred,
+                   stats->engine_waits, stats->engine_wait_usec,
+                   stats->bo_allocs, stats->bo_frees,
+                   stats->evictions, stats->restores,
+                   stats->placed_sys, stats->placed_vram,
+                   stats->shape_fills, stats->composite_noops,
+                   stats->peephole_dropped, stats->peephole_moved,
+                   stats->peephole_merged, stats->peephole_saved);
+    if (len >= sizeof(text))
+        len = sizeof(text) - 1;
+
+    name = MakeAtom(GLAMO_STATS_PROPERTY, strlen(GLAMO_STATS_PROPERTY), TRUE);
+    dixChangeWindowProperty(serverClient, pRoot, name, XA_STRING, 8,
+                            PropModeReplace, len, text, FALSE);
+}
+
+static void
+GlamoStatsBlockHandler(pointer data, OSTimePtr timeout, pointer read_mask)
+{
+    ScrnInfoPtr pScrn = data;
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+    CARD32 now = GetTimeInMillis();
+
+    if ((int)(now - pGlamo->stats.published) < GLAMO_STATS_INTERVAL)
+        return;
+
+    pGlamo->stats.published = now;
+    GlamoStatsPublish(pScrn);
+}
+
+unsigned long long
+GlamoStatsTime(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void
+GlamoStatsDump(ScrnInfoPtr pScrn)
+{
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+    struct glamo_stats *stats = &pGlamo->stats;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Acceleration: %lu solid, %lu copy, %lu upload "
+               "(%lu staged), %lu download, %lu CPU access\n",
+               stats->ops[GLAMO_STAT_SOLID],
+               stats->ops[GLAMO_STAT_COPY],
+               stats->ops[GLAMO_STAT_UPLOAD],
+               stats->ops[GLAMO_STAT_STAGED_UPLOAD],
+               stats->ops[GLAMO_STAT_DOWNLOAD],
+               stats->ops[GLAMO_STAT_CPU_ACCESS]);
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Fallbacks: %lu bpp, %lu planemask, %lu size, "
+               "%lu composite, %lu video memory\n",
+               stats->fallbacks[GLAMO_FALLBACK_BPP],
+               stats->fallbacks[GLAMO_FALLBACK_PLANEMASK],
+               stats->fallbacks[GLAMO_FALLBACK_SIZE],
+               stats->fallbacks[GLAMO_FALLBACK_COMPOSITE],
+               stats->fallbacks[GLAMO_FALLBACK_VRAM]);
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Submitted %llu bytes in %lu batches, "
+               "%lu waits for ring space\n",
+               stats->bytes_submitted, stats->submissions,
+               stats->ring_full_waits);
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Batches: %lu sent to an idle engine, %lu to a starved one, "
+               "%lu full, %lu held back\n",
+               stats->flushes_idle, stats->flushes_starved,
+               stats->flushes_full, stats->flushes_deferred);
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Waited for the engine %lu times, %llu us in total\n",
+               stats->engine_waits, stats->engine_wait_usec);
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Buffer objects: %lu allocated, %lu freed, "
+               "%lu evicted, %lu restored\n",
+               stats->bo_allocs, stats->bo_frees,
+               stats->evictions, stats->restores);
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Placement: %lu pixmaps to system memory, %lu back\n",
+               stats->placed_sys, stats->placed_vram);
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Render: %lu shape interiors filled, %lu composites "
+               "skipped as no-ops\n",
+               stats->shape_fills, stats->composite_noops);
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Peephole: %lu blits dropped as overdrawn, %lu moved, "
+               "%lu merged, %llu bytes saved\n",
+               stats->peephole_dropped, stats->peephole_moved,
+               stats->peephole_merged, stats->peephole_saved);
+}
+
+void
+GlamoStatsInit(ScrnInfoPtr pScrn)
+{
+    GlamoPtr pGlamo = GlamoPTR(pScrn);
+
+    memset(&pGlamo->stats, 0, sizeof(pGlamo->stats));
+    pGlamo->stats.published = GetTimeInMillis() - GLAMO_STATS_INTERVAL;
+
+    RegisterBlockAndWakeupHandlers(GlamoStatsBlockHandler,
+                                   (WakeupHandlerProcPtr)NoopDDA, pScrn);
+}
+
+void
+GlamoStatsFini(ScrnInfoPtr pScrn)
+{
+    RemoveBlockAndWakeupHandlers(GlamoStatsBlockHandler,
+                                 (WakeupHandlerProcPtr)NoopDDA, pScrn);
+
+    GlamoStatsDump(pScrn);
+    GLAMO_TIMING_WRITE(pScrn);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef _GLAMO_STATS_H_
+#define _GLAMO_STATS_H_
+
+#include "xf86.h"
+
+/*
+ * Counters for what the acceleration code does and why it declines.  They
+ * are always compiled in, cost an increment each, and are written to the
+ * log when the server gets SIGUSR1 and when the screen is closed.
+ */
+
+enum glamo_stat_op {
+	GLAMO_STAT_SOLID,		/* Solid() rectangles */
+	GLAMO_STAT_COPY,		/* Copy() rectangles */
+	GLAMO_STAT_UPLOAD,		/* UploadToScreen() calls */
+	GLAMO_STAT_STAGED_UPLOAD,	/* of those, blitted from staging */
+	GLAMO_STAT_DOWNLOAD,		/* DownloadFromScreen() calls */
+	GLAMO_STAT_CPU_ACCESS,		/* PrepareAccess() on video memory */
+	GLAMO_STAT_NUM_OPS
+};
+
+enum glamo_stat_fallback {
+	GLAMO_FALLBACK_BPP,		/* pixmap not 16bpp */
+	GLAMO_FALLBACK_PLANEMASK,	/* partial planemask */
+	GLAMO_FALLBACK_SIZE,		/* too large for the 2D engine */
+	GLAMO_FALLBACK_COMPOSITE,	/* CheckComposite() declined */
+	GLAMO_FALLBACK_VRAM,		/* no video memory for a pixmap */
+	GLAMO_FALLBACK_NUM
+};
+
+struct glamo_stats {
+	unsigned long ops[GLAMO_STAT_NUM_OPS];
+	unsigned long fallbacks[GLAMO_FALLBACK_NUM];
+
+	unsigned long submissions;
+	unsigned long long bytes_submitted;
+	unsigned long ring_full_waits;	/* dispatches that found no room */
+	unsigned long flushes_idle;	/* batches ended with the engine idle */
+	unsigned long flushes_starved;	/* cut short as the engine ran dry */
+	unsigned long flushes_full;	/* dispatched at the batch size */
+	unsigned long flushes_deferred;	/* kept while the engine was busy */
+
+	unsigned long engine_waits;	/* waits that found the engine busy */
+	unsigned long long engine_wait_usec;
+
+	unsigned long bo_allocs;
+	unsigned long bo_frees;
+	unsigned long placed_sys;	/* pixmaps moved to system memory */
+	unsigned long placed_vram;	/* and back */
+	unsigned long evictions;	/* pixmaps evicted from video memory */
+	unsigned long restores;		/* and brought back */
+	unsigned long shape_fills;	/* trapezoid interiors filled */
+	unsigned long composite_noops;	/* composites which change nothing */
+
+	unsigned long peephole_dropped;	/* blits overdrawn in their batch */
+	unsigned long peephole_moved;	/* blits moved to share state */
+	unsigned long peephole_merged;	/* fills merged with a neighbour */
+	unsigned long long peephole_saved;	/* command bytes saved */
+
+	CARD32 published;		/* when _GLAMO_STATS was updated */
+};
+
+#define GLAMO_STAT_OP(pGlamo, op)	((pGlamo)->stats.ops[op]++)
+
+void
+GlamoStatsInit(ScrnInfoPtr pScrn);
+
+void
+GlamoStatsFini(ScrnInfoPtr pScrn);
+
+void
+GlamoStatsDump(ScrnInfoPtr pScrn);
+
+/* Time stamp, in microseconds, for the engine wait counters */
+unsigned long long
+GlamoStatsTime(void);
+
+#endif /* _GLAMO_STATS_H_ */
@@ -0,0 +1,209 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * The submission thread (Option "SubmitThread").  The slots need no lock:
+ * each index is written by one thread only.  The semaphores order the
+ * threads' accesses to the slots and put them to sleep when the queue is
+ * empty or full, rather than spinning on a CPU the X thread needs; while
+ * neither has to sleep they cost an atomic operation each, not a system
+ * call.  When all slots are queued, the X thread waits for one to be
+ * submitted, so the queue can't grow without bound.  The mutex and
+ * condition only serve GlamoSubmitWait(), which the X thread calls for
+ * shared buffers and fence waits.
+ *
+ * The buffer objects a command buffer refers to are referenced until it
+ * has been submitted, since their pixmaps may be destroyed meanwhile.
+ * libdrm isn't thread safe, so the X thread drops those references.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "glamo.h"
+#include "glamo-drm.h"
+#include "glamo-submit.h"
+
+static void *
+GlamoSubmitThread(void *arg)
+{
+	struct glamo_submit_queue *q = arg;
+	struct glamo_submission *sub;
+
+	for (;;) {
+		while (sem_wait(&q->queued) == -1 && errno == EINTR)
+			;
+		if (q->tail == q->head && q->quit)
+			break;
+
+		sub = &q->slots[q->tail % GLAMO_SUBMIT_SLOTS];
+		if (q->submit(q->data, sub) != 0)
+			__sync_fetch_and_add(&q->errors, 1);
+
+		__sync_synchronize();
+		q->tail++;
+
+		pthread_mutex_lock(&q->lock);
+		q->submitted = sub->seq;
+		pthread_cond_broadcast(&q->done);
+		pthread_mutex_unlock(&q->lock);
+
+		sem_post(&q->space);
+	}
+
+	return NULL;
+}
+
+/* Drop the references of the command buffers which have been submitted */
+static void
+GlamoSubmitReclaim(struct glamo_submit_queue *q)
+{
+	struct glamo_submission *sub;
+	unsigned int tail = q->tail;
+	int i;
+
+	__sync_synchronize();
+
+	for (; q->reclaimed != tail; q->reclaimed++) {
+		sub = &q->slots[q->reclaimed % GLAMO_SUBMIT_SLOTS];
+		for (i = 0; i < sub->nobjs; i++)
+			glamo_bo_unref(sub->bos[i]);
+		sub->nobjs = 0;
+	}
+}
+
+static void
+GlamoSubmitFree(struct glamo_submit_queue *q)
+{
+	int i;
+
+	for (i = 0; i < GLAMO_SUBMIT_SLOTS; i++) {
+		free(q->slots[i].cmds);
+		free(q->slots[i].objs);
+		free(q->slots[i].obj_pos);
+		free(q->slots[i].bos);
+	}
+	free(q);
+}
+
+struct glamo_submit_queue *
+GlamoSubmitCreate(GlamoSubmitProc submit, void *data,
+                  int max_cmd_bytes, int max_objs)
+{
+	struct glamo_submit_queue *q;
+	sigset_t all, old;
+	int i, r;
+
+	q = calloc(1, sizeof(*q));
+	if (!q)
+		return NULL;
+
+	for (i = 0; i < GLAMO_SUBMIT_SLOTS; i++) {
+		q->slots[i].cmds = malloc(max_cmd_bytes);
+		q->slots[i].objs = malloc(max_objs * sizeof(uint32_t));
+		q->slots[i].obj_pos = malloc(max_objs * sizeof(unsigned int));
+		q->slots[i].bos = malloc(max_objs * sizeof(struct glamo_bo *));
+		if (!q->slots[i].cmds || !q->slots[i].objs ||
+		    !q->slots[i].obj_pos || !q->slots[i].bos) {
+			GlamoSubmitFree(q);
+			return NULL;
+		}
+	}
+
+	q->submit = submit;
+	q->data = data;
+	sem_init(&q->queued, 0, 0);
+	sem_init(&q->space, 0, GLAMO_SUBMIT_SLOTS - 1);
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->done, NULL);
+
+	/* The server's signals (input, the scheduler's timer) must go to the
+	 * X thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	r = pthread_create(&q->thread, NULL, GlamoSubmitThread, q);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (r != 0) {
+		pthread_cond_destroy(&q->done);
+		pthread_mutex_destroy(&q->lock);
+		sem_destroy(&q->space);
+		sem_destroy(&q->queued);
+		GlamoSubmitFree(q);
+		return NULL;
+	}
+
+	return q;
+}
+
+/* Wait for everything queued to be submitted, and stop the thread */
+void
+GlamoSubmitDestroy(struct glamo_submit_queue *q)
+{
+	q->quit = TRUE;
+	sem_post(&q->queued);
+	pthread_join(q->thread, NULL);
+
+	GlamoSubmitReclaim(q);
+
+	pthread_cond_destroy(&q->done);
+	pthread_mutex_destroy(&q->lock);
+	sem_destroy(&q->space);
+	sem_destroy(&q->queued);
+	GlamoSubmitFree(q);
+}
+
+/* Queue the current slot for submission and move on to the next one.
+ * Returns FALSE if that meant waiting for a slot to become free. */
+Bool
+GlamoSubmitQueue(struct glamo_submit_queue *q)
+{
+	Bool waited = FALSE;
+
+	__sync_synchronize();
+	q->head++;
+	sem_post(&q->queued);
+
+	if (sem_trywait(&q->space) == -1) {
+		waited = TRUE;
+		while (sem_wait(&q->space) == -1 && errno == EINTR)
+			;
+	}
+
+	GlamoSubmitReclaim(q);
+
+	return !waited;
+}
+
+/* Wait for the submission with fence seq to be handed to the kernel */
+void
+GlamoSubmitWait(struct glamo_submit_queue *q, unsigned int seq)
+{
+	if (q->tail == q->head)
+		return;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->tail != q->head && GLAMO_SEQ_AFTER(seq, q->submitted))
+		pthread_cond_wait(&q->done, &q->lock);
+	pthread_mutex_unlock(&q->lock);
+}
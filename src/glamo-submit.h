@@ -0,0 +1,96 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef _GLAMO_SUBMIT_H_
+#define _GLAMO_SUBMIT_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <glamo_bo.h>
+
+#include "xf86.h"
+
+/*
+ * A queue of command buffers between the X thread, which fills them, and a
+ * thread which hands them to the kernel, so that the server goes on
+ * handling requests while the kernel waits for room in the command queue.
+ * One slot is being filled; the others may be waiting for the thread.
+ */
+
+#define GLAMO_SUBMIT_SLOTS 4
+
+struct glamo_submission {
+	uint16_t *cmds;
+	int cmd_bytes;
+	uint32_t *objs;			/* relocations: GEM handles */
+	unsigned int *obj_pos;		/* and their byte offsets */
+	struct glamo_bo **bos;		/* referenced until submitted */
+	int nobjs;
+	unsigned int seq;		/* fence (see glamo-drm.c) */
+};
+
+/* Hands a command buffer to the kernel, returning zero or an error.  It
+ * runs on the submission thread, so it mustn't touch server state. */
+typedef int (*GlamoSubmitProc)(void *data, struct glamo_submission *sub);
+
+struct glamo_submit_queue {
+	struct glamo_submission slots[GLAMO_SUBMIT_SLOTS];
+
+	/* Slots tail to head - 1, modulo GLAMO_SUBMIT_SLOTS, are queued.  The
+	 * X thread moves head and the submission thread moves tail. */
+	volatile unsigned int head;
+	volatile unsigned int tail;
+	unsigned int reclaimed;		/* slots whose references are dropped */
+	sem_t queued;
+	sem_t space;
+
+	/* Fence of the last submission made, for waiting on */
+	volatile unsigned int submitted;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+
+	volatile unsigned int errors;	/* failed submissions */
+	volatile int quit;
+
+	GlamoSubmitProc submit;
+	void *data;
+	pthread_t thread;
+};
+
+struct glamo_submit_queue *
+GlamoSubmitCreate(GlamoSubmitProc submit, void *data,
+                  int max_cmd_bytes, int max_objs);
+
+void
+GlamoSubmitDestroy(struct glamo_submit_queue *q);
+
+/* The slot being filled */
+#define GlamoSubmitCurrent(q) (&(q)->slots[(q)->head % GLAMO_SUBMIT_SLOTS])
+
+Bool
+GlamoSubmitQueue(struct glamo_submit_queue *q);
+
+void
+GlamoSubmitWait(struct glamo_submit_queue *q, unsigned int seq);
+
+#endif /* _GLAMO_SUBMIT_H_ */
@@ -0,0 +1,151 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Latency trace ring for --enable-timing, see glamo-timing.h.
+ *
+ * Events are claimed with an atomic increment of the head, so recording
+ * never takes a lock.  The ring keeps the most recent
+ * GLAMO_TIMING_RING_SIZE events; older ones are overwritten.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "glamo.h"
+#include "glamo-timing.h"
+
+#define GLAMO_TIMING_RING_SIZE 65536	/* must be a power of two */
+
+struct glamo_timing_event {
+    uint64_t start;		/* ns, CLOCK_MONOTONIC */
+    uint32_t duration;		/* ns */
+    uint32_t phase;
+};
+
+static const char *glamo_timing_names[GLAMO_NUM_PHASES] = {
+    [GLAMO_PHASE_PREPARE] = "prepare",
+    [GLAMO_PHASE_EMIT] = "emit",
+    [GLAMO_PHASE_DISPATCH] = "dispatch",
+    [GLAMO_PHASE_RING_WAIT] = "ring wait",
+    [GLAMO_PHASE_ENGINE_WAIT] = "engine wait",
+    [GLAMO_PHASE_ACCESS_WAIT] = "access wait",
+};
+
+static struct glamo_timing_event glamo_timing_ring[GLAMO_TIMING_RING_SIZE];
+static unsigned int glamo_timing_head;
+static uint64_t glamo_timing_emit_start;
+
+void
+GlamoTimingRecord(enum glamo_timing_phase phase, uint64_t start,
+                  uint64_t end)
+{
+    struct glamo_timing_event *event;
+    unsigned int i;
+
+    i = __sync_fetch_and_add(&glamo_timing_head, 1);
+    event = &glamo_timing_ring[i & (GLAMO_TIMING_RING_SIZE - 1)];
+    event->start = start;
+    event->duration = end - start;
+    event->phase = phase;
+}
+
+void
+GlamoTimingEmitBegin(void)
+{
+    glamo_timing_emit_start = GlamoTimingNow();
+}
+
+void
+GlamoTimingEmitEnd(void)
+{
+    if (!glamo_timing_emit_start)
+        return;
+
+    GlamoTimingRecord(GLAMO_PHASE_EMIT, glamo_timing_emit_start,
+                      GlamoTimingNow());
+    glamo_timing_emit_start = 0;
+}
+
+/* Write the ring, oldest event first, as a Chrome trace */
+void
+GlamoTimingWrite(ScrnInfoPtr pScrn)
+{
+    const struct glamo_timing_event *event;
+    const char *filename, *sep = "";
+    unsigned int head, first, i;
+    FILE *f;
+    int pid;
+
+    filename = getenv("GLAMO_TIMING");
+    if (!filename || !*filename)
+        return;
+    if (GlamoPrivsElevated()) {
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "Ignoring GLAMO_TIMING in a privileged server\n");
+        return;
+    }
+
+    f = fopen(filename, "w");
+    if (!f) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                   "Couldn't open \"%s\" for the timing trace: %s\n",
+                   filename, strerror(errno));
+        return;
+    }
+
+    head = glamo_timing_head;
+    first = 0;
+    if (head > GLAMO_TIMING_RING_SIZE)
+        first = head - GLAMO_TIMING_RING_SIZE;
+    pid = getpid();
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (i = first; i != head; i++) {
+        event = &glamo_timing_ring[i & (GLAMO_TIMING_RING_SIZE - 1)];
+        if (event->phase >= GLAMO_NUM_PHASES)
+            continue;
+        fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"glamo\",\"ph\":\"X\","
+                   "\"pid\":%d,\"tid\":%d,"
+                   "\"ts\":%llu.%03u,\"dur\":%u.%03u}\n",
+                sep,
+                glamo_timing_names[event->phase], pid, pScrn->scrnIndex,
+                (unsigned long long)(event->start / 1000),
+                (unsigned int)(event->start % 1000),
+                event->duration / 1000, event->duration % 1000);
+        sep = ",";
+    }
+    fprintf(f, "]}\n");
+
+    if (fclose(f) == 0) {
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "Wrote %u timing events to \"%s\"\n",
+                   head - first, filename);
+    } else {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                   "Couldn't write \"%s\": %s\n", filename,
+                   strerror(errno));
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef _GLAMO_TIMING_H_
+#define _GLAMO_TIMING_H_
+
+/*
+ * Per-phase latency tracing of the acceleration paths, built with
+ * --enable-timing.  Each phase becomes one event in an in-memory ring,
+ * which is written out as a Chrome trace (chrome://tracing, Perfetto) to the
+ * file named by the GLAMO_TIMING environment variable.  Without
+ * --enable-timing all of the macros below expand to nothing.
+ *
+ * Prepare and emit are recorded once per batch, not per rectangle: emit is
+ * the time from the end of Prepare*() to the start of Done*().
+ */
+
+enum glamo_timing_phase {
+	GLAMO_PHASE_PREPARE,
+	GLAMO_PHASE_EMIT,
+	GLAMO_PHASE_DISPATCH,
+	GLAMO_PHASE_RING_WAIT,
+	GLAMO_PHASE_ENGINE_WAIT,
+	GLAMO_PHASE_ACCESS_WAIT,
+	GLAMO_NUM_PHASES
+};
+
+#ifdef GLAMO_TIMING
+
+#include <stdint.h>
+#include <time.h>
+
+#include "xf86.h"
+
+static inline uint64_t
+GlamoTimingNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+GlamoTimingRecord(enum glamo_timing_phase phase, uint64_t start,
+                  uint64_t end);
+
+void
+GlamoTimingEmitBegin(void);
+
+void
+GlamoTimingEmitEnd(void);
+
+void
+GlamoTimingWrite(ScrnInfoPtr pScrn);
+
+#define GLAMO_TIMING_LOCAL(t)		uint64_t t
+#define GLAMO_TIMING_BEGIN(t)		((t) = GlamoTimingNow())
+#define GLAMO_TIMING_END(t, phase)					\
+	GlamoTimingRecord(phase, t, GlamoTimingNow())
+#define GLAMO_TIMING_EMIT_BEGIN()	GlamoTimingEmitBegin()
+#define GLAMO_TIMING_EMIT_END()		GlamoTimingEmitEnd()
+#define GLAMO_TIMING_WRITE(pScrn)	GlamoTimingWrite(pScrn)
+
+#else
+
+#define GLAMO_TIMING_LOCAL(t)
+#define GLAMO_TIMING_BEGIN(t)
+#define GLAMO_TIMING_END(t, phase)
+#define GLAMO_TIMING_EMIT_BEGIN()
+#define GLAMO_TIMING_EMIT_END()
+#define GLAMO_TIMING_WRITE(pScrn)
+
+#endif /* GLAMO_TIMING */
+
+#endif /* _GLAMO_TIMING_H_ */
@@ -34,12 +34,17 @@
 #include "config.h"
 #endif
 
+#include <string.h>
+#include <unistd.h>
+
 #include "xf86.h"
 #include "exa.h"
 #include <linux/fb.h>
 #include <libdrm/drm.h>
 #include <libdrm/glamo_bo.h>
 
+#include "glamo-stats.h"
+
 #define GLAMO_REG_BASE(c)		((c)->attr.address[0])
 #define GLAMO_REG_SIZE(c)		(0x2400)
 
@@ -75,8 +80,21 @@ MMIO_IN16(__volatile__ void *base, const unsigned long offset)
 
 #endif
 
-/* The number of EXA wait markers which can be active at once */
-#define NUM_EXA_BUFFER_MARKERS 32
+/* Limits of the 2D engine: the pitch registers hold at most 0x7ff bytes,
+ * and coordinates are taken to reach GLAMO_2D_MAX_COORD.  The address
+ * registers reach all 8 MiB of video memory. */
+#define GLAMO_2D_MAX_PITCH	0x7ff
+#define GLAMO_2D_MAX_COORD	1024
+
+/* The number of submissions to the kernel whose fences are remembered */
+#define GLAMO_NUM_FENCES 32
+
+/* Video memory for uploads to pixmaps the engine is still using: the data
+ * is written to a part of it the engine is done with, and blitted into
+ * place behind the commands already queued.  With DRM, the area is made
+ * of separate buffer objects, since relocations can't point inside one. */
+#define GLAMO_STAGING_SIZE	(128 * 1024)
+#define GLAMO_KMS_STAGING_SLOTS	4
 
 typedef volatile CARD16        VOL16;
 
@@ -89,6 +107,7 @@ typedef struct _MemBuf {
 typedef struct {
 	Bool					shadowFB;
 	void					*shadow;
+	size_t					shadow_size;
 	CloseScreenProcPtr		CloseScreen;
 	CreateScreenResourcesProcPtr CreateScreenResources;
 	void					(*PointerMoved)(int index, int x, int y);
@@ -102,6 +121,10 @@ typedef struct {
     unsigned char *ring_addr; /* Beginning of ring buffer. */
     size_t ring_start;
 	size_t ring_len;
+	/* Commands held back while the engine is busy, at most, and the
+	 * amount queued at which GLAMOKickCMDQ() looks at the engine next */
+	size_t batch_size;
+	size_t kick_next;
 
 	/*
 	 * cmd queue in system memory
@@ -117,10 +140,23 @@ typedef struct {
 	int cmdq_obj_used;
 	uint32_t *cmdq_objs;
 	unsigned int *cmdq_obj_pos;
+	struct glamo_bo **cmdq_bos;  /* With the submission thread, the
+	                              * buffer objects of the relocations */
 	struct glamo_bo *last_buffer_object;  /* The last buffer object
 	                                       * referenced in the cmdq */
-	struct glamo_bo *exa_buffer_markers[NUM_EXA_BUFFER_MARKERS];
-	unsigned int exa_marker_index;  /* Index into exa_buffer_markers */
+	/* Fences of the last submissions, by sequence number modulo
+	 * GLAMO_NUM_FENCES (see glamo-drm.c) */
+	struct glamo_fence {
+		unsigned int seq;
+		struct glamo_bo *bo;
+	} fences[GLAMO_NUM_FENCES];
+	unsigned int fence_seq;      /* Last submission */
+	unsigned int fence_retired;  /* Last submission known to be done */
+	unsigned int exported_seq;   /* Last one using a DRI2 buffer */
+	/* The submission thread, if enabled (see glamo-submit.c), and the
+	 * number of its failed submissions already reported */
+	struct glamo_submit_queue *submit_queue;
+	unsigned int submit_errors;
 
 	/* What was GLAMOCardInfo */
 	volatile char *reg_base;
@@ -151,6 +187,44 @@ typedef struct {
 
 /* Use hardware acceleration */
     Bool accel;
+    /* Use the simulated registers and 2D engine (glamo-sim.c) */
+    Bool sim;
+    /* Status reads for which the simulator leaves a dispatched batch
+     * pending, so that the engine runs behind the CPU; 0 runs it at once */
+    int sim_latency, sim_pending;
+    /* Command stream capture file (glamo-capture.c), or -1 */
+    int capture_fd;
+    /* Optimise batches before submitting them (glamo-peephole.c) */
+    Bool peephole;
+    /* Source of the current Copy(), for splitting blits on tall pixmaps */
+    PixmapPtr copy_src;
+    /* How the current Composite() is done (glamo-render.c) */
+    int composite;
+    /* Render's compositing and its trapezoid and triangle rasterisation,
+     * wrapped by glamo-render.c */
+    CompositeProcPtr Composite;
+    TrapezoidsProcPtr Trapezoids;
+    TrianglesProcPtr Triangles;
+    /* Video memory used by the commands being queued, and by the batch
+     * the engine may still be running, so that uploads and downloads only
+     * wait when they touch it */
+    CARD32 queued_start, queued_end;
+    CARD32 busy_start, busy_end;
+    /* Video memory used by the operation being queued, from Prepare*() to
+     * Done*(), which stays queued when a batch is dispatched in its middle */
+    CARD32 op_start, op_end;
+    /* Staging area for uploads, used from staging_head onwards */
+    CARD32 staging_start;
+    size_t staging_size, staging_head;
+    /* The same when using DRM, used from staging_next onwards */
+    struct glamo_bo *staging_bo[GLAMO_KMS_STAGING_SLOTS];
+    unsigned int staging_seq[GLAMO_KMS_STAGING_SLOTS];
+    int staging_next;
+    /* Pixmaps in video memory when using DRM, in order of use */
+    struct glamo_exa_pixmap_priv *lru_first, *lru_last;
+
+    /* Acceleration counters (glamo-stats.c) */
+    struct glamo_stats stats;
 
     /* Things to do with DRI */
     int drm_fd;
@@ -158,6 +232,10 @@ typedef struct {
     unsigned int fb_id;
     char drm_devname[64];
     struct glamo_bo_manager *bufmgr;
+    struct glamo_dri2_pool_entry *dri2_pool;
+    OsTimerPtr dri2_pool_timer;
+    Bool dri2_flip_pending;
+    struct glamo_dri2_swap_info *dri2_swaps;
 
     uint16_t *colormap;
 } GlamoRec, *GlamoPtr;
@@ -178,10 +256,43 @@ MMIOSetBitMask(volatile char *mmio, CARD32 reg, CARD16 mask, CARD16 val)
 	MMIO_OUT16(mmio, reg, tmp);
 }
 
+/* Whether the server runs with more privileges than the user who started
+ * it, so that files named in the environment mustn't be written */
+static inline Bool
+GlamoPrivsElevated(void)
+{
+#if XORG_VERSION_CURRENT >= XORG_VERSION_NUMERIC(1,15,99,903,0)
+	return xf86PrivsElevated();
+#else
+	return getuid() != geteuid() || getgid() != getegid();
+#endif
+}
+
+/* Copy h rows of width bytes, with a single memcpy if neither side has
+ * any padding between rows */
+static inline void
+GlamoCopyRows(unsigned char *dst, int dst_pitch,
+              const unsigned char *src, int src_pitch, int width, int h)
+{
+	if (dst_pitch == width && src_pitch == width) {
+		memcpy(dst, src, width * h);
+		return;
+	}
+
+	while (h--) {
+		memcpy(dst, src, width);
+		dst += dst_pitch;
+		src += src_pitch;
+	}
+}
+
 /* glamo_draw.c */
 size_t
 GLAMODrawInit(ScrnInfoPtr pScrn, size_t mem_start, size_t mem_len);
 
+Bool
+GLAMODrawResize(ScrnInfoPtr pScrn, size_t front_size);
+
 Bool
 GLAMODrawEnable(ScrnInfoPtr pScrn);
 
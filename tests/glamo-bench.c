@@ -0,0 +1,181 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Time the EXA hooks of the framebuffer path on the simulated glamo, and
+ * count the command bytes and submissions they cost per rectangle.  The
+ * times include the simulated engine, so they only compare the driver's
+ * own overhead between settings for small rectangles; the byte and
+ * submission counts are what the real engine would see.
+ *
+ * usage: glamo-bench [-n count] [-b batch-kib] [-l latency] [-p]
+ *   -n  rectangles per test (default 100000)
+ *   -b  Option "BatchSize", in KiB
+ *   -l  status reads the simulated engine takes over each batch
+ *   -p  Option "Peephole"
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "glamo.h"
+#include "glamo-test.h"
+
+/* Rectangles per Prepare*() and Done*(), about what EXA gets from a
+ * region of a few boxes */
+#define BENCH_RECTS_PER_OP	16
+
+enum bench_op {
+    BENCH_FILL,
+    BENCH_COPY,
+    BENCH_UPLOAD,
+};
+
+static const struct {
+    const char *name;
+    enum bench_op op;
+    int size;
+} tests[] = {
+    { "fill 1x1", BENCH_FILL, 1 },
+    { "fill 8x8", BENCH_FILL, 8 },
+    { "fill 64x64", BENCH_FILL, 64 },
+    { "copy 8x8", BENCH_COPY, 8 },
+    { "copy 64x64", BENCH_COPY, 64 },
+    { "upload 8x8", BENCH_UPLOAD, 8 },
+    { "upload 64x64", BENCH_UPLOAD, 64 },
+};
+
+static void
+RunTest(GlamoPtr pGlamo, PixmapPtr pSrc, PixmapPtr pDst, enum bench_op op,
+        int size, int count)
+{
+    ExaDriverPtr exa = pGlamo->exa;
+    CARD16 data[64 * 64];
+    int range = pDst->drawable.width - size;
+    int i, x, y;
+
+    for (i = 0; i < count; i++) {
+        x = (i * 7) % range;
+        y = (i * 13) % range;
+
+        switch (op) {
+        case BENCH_FILL:
+            if (i % BENCH_RECTS_PER_OP == 0)
+                exa->PrepareSolid(pDst, GXcopy, ~0, i);
+            exa->Solid(pDst, x, y, x + size, y + size);
+            if (i % BENCH_RECTS_PER_OP == BENCH_RECTS_PER_OP - 1)
+                exa->DoneSolid(pDst);
+            break;
+        case BENCH_COPY:
+            if (i % BENCH_RECTS_PER_OP == 0)
+                exa->PrepareCopy(pSrc, pDst, 1, 1, GXcopy, ~0);
+            exa->Copy(pDst, y, x, x, y, size, size);
+            if (i % BENCH_RECTS_PER_OP == BENCH_RECTS_PER_OP - 1)
+                exa->DoneCopy(pDst);
+            break;
+        case BENCH_UPLOAD:
+            exa->UploadToScreen(pDst, x, y, size, size, (char *)data,
+                                size * 2);
+            break;
+        }
+    }
+
+    if (i % BENCH_RECTS_PER_OP) {
+        if (op == BENCH_FILL)
+            exa->DoneSolid(pDst);
+        else if (op == BENCH_COPY)
+            exa->DoneCopy(pDst);
+    }
+
+    GlamoTestSync();
+}
+
+int
+main(int argc, char **argv)
+{
+    GlamoPtr pGlamo;
+    PixmapPtr pSrc, pDst;
+    unsigned long long start, usec;
+    unsigned long long bytes;
+    unsigned long submissions;
+    size_t batch_size = 0;
+    int count = 100000, latency = 0;
+    Bool peephole = FALSE;
+    int i, c;
+
+    while ((c = getopt(argc, argv, "n:b:l:p")) != -1) {
+        switch (c) {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'b':
+            batch_size = atoi(optarg) * 1024;
+            break;
+        case 'l':
+            latency = atoi(optarg);
+            break;
+        case 'p':
+            peephole = TRUE;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n count] [-b batch-kib] "
+                    "[-l latency] [-p]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (count <= 0)
+        count = 1;
+
+    printf("%-14s %10s %12s %12s\n", "test", "ns/rect", "bytes/rect",
+           "rects/batch");
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        pGlamo = GlamoTestInit(batch_size);
+        pGlamo->sim_latency = latency;
+        pGlamo->peephole = peephole;
+        pSrc = GlamoTestPixmap(256, 256);
+        pDst = GlamoTestPixmap(256, 256);
+
+        bytes = pGlamo->stats.bytes_submitted;
+        submissions = pGlamo->stats.submissions;
+        start = GlamoStatsTime();
+
+        RunTest(pGlamo, pSrc, pDst, tests[i].op, tests[i].size, count);
+
+        usec = GlamoStatsTime() - start;
+        bytes = pGlamo->stats.bytes_submitted - bytes;
+        submissions = pGlamo->stats.submissions - submissions;
+
+        printf("%-14s %10.0f %12.1f %12.1f\n", tests[i].name,
+               usec * 1000.0 / count, (double)bytes / count,
+               submissions ? (double)count / submissions : 0.0);
+
+        GlamoTestFini();
+    }
+
+    return 0;
+}
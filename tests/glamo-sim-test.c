@@ -0,0 +1,645 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Run the EXA hooks of the framebuffer path on the simulated glamo, and
+ * check what they leave in video memory: fills and copies with each of the
+ * X raster ops against pixman and the raster ops as fb defines them, on
+ * pixmaps short enough for one blit and tall enough to need bands, and
+ * with the engine running in step with the CPU and behind it.  Random
+ * batches of blits are also run with and without the peephole pass, with
+ * the addresses written out and with relocations, and must leave the same
+ * pixels and registers behind.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pixman.h>
+
+#include "glamo.h"
+#include "glamo-regs.h"
+#include "glamo-cmdq.h"
+#include "glamo-peephole.h"
+#include "glamo-test.h"
+
+/* Small enough batches that a few rectangles fill one, and an engine which
+ * takes long enough over each that the CPU gets ahead of it */
+#define TEST_BATCH_SIZE		1024
+#define TEST_SIM_LATENCY	1000
+
+#define TEST_WIDTH		64
+#define TEST_HEIGHT		64
+
+/* Taller than the coordinate registers reach */
+#define TEST_TALL_WIDTH		32
+#define TEST_TALL_HEIGHT	1300
+
+#define TEST_RECTS		8
+
+/* Batches for the peephole pass: blits on a few surfaces, placed on a
+ * coarse grid so that they often cover, adjoin or repeat one another */
+#define TEST_PP_SURFACES	3
+#define TEST_PP_BATCHES		200
+#define TEST_PP_BLITS		24
+#define TEST_PP_GRID		8
+#define TEST_PP_MAX_COUNT	(TEST_PP_BLITS * 40)
+#define TEST_PP_MAX_RELOCS	(TEST_PP_BLITS * 2)
+
+/* A pixmap in video memory, and the reference drawing of it in system
+ * memory */
+typedef struct {
+    PixmapPtr pPix;
+    pixman_image_t *ref;
+} TestSurface;
+
+/* The X raster ops, as fb applies them */
+static CARD16
+RefRop(int alu, CARD16 src, CARD16 dst)
+{
+    switch (alu) {
+    case GXclear:		return 0;
+    case GXand:			return src & dst;
+    case GXandReverse:		return src & ~dst;
+    case GXcopy:		return src;
+    case GXandInverted:		return ~src & dst;
+    case GXnoop:		return dst;
+    case GXxor:			return src ^ dst;
+    case GXor:			return src | dst;
+    case GXnor:			return ~(src | dst);
+    case GXequiv:		return ~src ^ dst;
+    case GXinvert:		return ~dst;
+    case GXorReverse:		return src | ~dst;
+    case GXcopyInverted:	return ~src;
+    case GXorInverted:		return ~src | dst;
+    case GXnand:		return ~(src & dst);
+    default:			return 0xffff;
+    }
+}
+
+#define REF_PIXEL(ref, x, y)						\
+	(((CARD16 *)((CARD8 *)pixman_image_get_data(ref) +		\
+		     (y) * pixman_image_get_stride(ref)))[x])
+
+/* A pixmap of random pixels */
+static void
+SurfaceInit(TestSurface *s, int width, int height)
+{
+    int x, y;
+
+    s->pPix = GlamoTestPixmap(width, height);
+    s->ref = pixman_image_create_bits(PIXMAN_r5g6b5, width, height, NULL,
+                                      s->pPix->devKind);
+    if (!s->ref)
+        exit(1);
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            CARD16 p = rand();
+
+            GLAMO_TEST_PIXEL(s->pPix, x, y) = p;
+            REF_PIXEL(s->ref, x, y) = p;
+        }
+    }
+}
+
+static void
+SurfaceFini(TestSurface *s)
+{
+    pixman_image_unref(s->ref);
+}
+
+/* Wait for the engine, and compare the pixmap with its reference.  The
+ * reference takes the pixmap's pixels after a mismatch, so that each
+ * failure is only reported once. */
+static void
+SurfaceCheck(TestSurface *s, const char *what, int alu)
+{
+    int x, y;
+
+    GlamoTestSync();
+
+    for (y = 0; y < s->pPix->drawable.height; y++) {
+        for (x = 0; x < s->pPix->drawable.width; x++) {
+            CARD16 p = GLAMO_TEST_PIXEL(s->pPix, x, y);
+            CARD16 r = REF_PIXEL(s->ref, x, y);
+
+            if (p != r) {
+                GLAMO_TEST_CHECK(p == r, "%s, alu %d, %dx%d pixmap: "
+                                 "pixel %d,%d is 0x%04x, not 0x%04x",
+                                 what, alu, s->pPix->drawable.width,
+                                 s->pPix->drawable.height, x, y, p, r);
+                memcpy(pixman_image_get_data(s->ref), s->pPix->devPrivate.ptr,
+                       s->pPix->devKind * s->pPix->drawable.height);
+                return;
+            }
+        }
+    }
+}
+
+/* A random rectangle of size w x h within a surface */
+static void
+RandomPlace(TestSurface *s, int w, int h, int *x, int *y)
+{
+    *x = rand() % (s->pPix->drawable.width - w + 1);
+    *y = rand() % (s->pPix->drawable.height - h + 1);
+}
+
+static void
+RandomSize(TestSurface *s, int *w, int *h)
+{
+    *w = 1 + rand() % s->pPix->drawable.width;
+    *h = 1 + rand() % s->pPix->drawable.height;
+}
+
+static void
+RefSolid(TestSurface *s, int alu, CARD16 fg, int x, int y, int w, int h)
+{
+    int i, j;
+
+    if (alu == GXcopy) {
+        pixman_fill(pixman_image_get_data(s->ref),
+                    pixman_image_get_stride(s->ref) / 4, 16, x, y, w, h, fg);
+        return;
+    }
+
+    for (j = y; j < y + h; j++) {
+        for (i = x; i < x + w; i++)
+            REF_PIXEL(s->ref, i, j) = RefRop(alu, fg,
+                                             REF_PIXEL(s->ref, i, j));
+    }
+}
+
+/* Copies read the whole source before writing, as if the engine picked the
+ * right direction for overlapping ones */
+static void
+RefCopy(TestSurface *src, TestSurface *dst, int alu, int sx, int sy,
+        int dx, int dy, int w, int h)
+{
+    pixman_image_t *tmp;
+    int i, j;
+
+    tmp = pixman_image_create_bits(PIXMAN_r5g6b5, w, h, NULL, 0);
+    if (!tmp)
+        exit(1);
+    pixman_image_composite32(PIXMAN_OP_SRC, src->ref, NULL, tmp,
+                             sx, sy, 0, 0, 0, 0, w, h);
+
+    if (alu == GXcopy) {
+        pixman_image_composite32(PIXMAN_OP_SRC, tmp, NULL, dst->ref,
+                                 0, 0, 0, 0, dx, dy, w, h);
+    } else {
+        for (j = 0; j < h; j++) {
+            for (i = 0; i < w; i++) {
+                REF_PIXEL(dst->ref, dx + i, dy + j) =
+                    RefRop(alu, REF_PIXEL(tmp, i, j),
+                           REF_PIXEL(dst->ref, dx + i, dy + j));
+            }
+        }
+    }
+
+    pixman_image_unref(tmp);
+}
+
+/* Fills of random rectangles with each raster op */
+static void
+TestFills(int latency)
+{
+    GlamoPtr pGlamo = GlamoTestInit(0);
+    TestSurface surfaces[2];
+    int alu, i, n, x, y, w, h;
+    CARD16 fg;
+
+    pGlamo->sim_latency = latency;
+    SurfaceInit(&surfaces[0], TEST_WIDTH + 36, TEST_HEIGHT + 16);
+    SurfaceInit(&surfaces[1], TEST_TALL_WIDTH, TEST_TALL_HEIGHT);
+
+    for (alu = 0; alu < 16; alu++) {
+        for (i = 0; i < 2; i++) {
+            TestSurface *s = &surfaces[i];
+
+            fg = rand();
+            if (!pGlamo->exa->PrepareSolid(s->pPix, alu, ~0, fg)) {
+                GLAMO_TEST_CHECK(FALSE, "fill, alu %d: declined", alu);
+                continue;
+            }
+            for (n = 0; n < TEST_RECTS; n++) {
+                RandomSize(s, &w, &h);
+                RandomPlace(s, w, h, &x, &y);
+                pGlamo->exa->Solid(s->pPix, x, y, x + w, y + h);
+                RefSolid(s, alu, fg, x, y, w, h);
+            }
+            pGlamo->exa->DoneSolid(s->pPix);
+
+            SurfaceCheck(s, "fill", alu);
+        }
+    }
+
+    SurfaceFini(&surfaces[0]);
+    SurfaceFini(&surfaces[1]);
+    GlamoTestFini();
+}
+
+/* Copies of random rectangles with each raster op, between pixmaps and
+ * within one, where they overlap */
+static void
+TestCopies(int latency)
+{
+    GlamoPtr pGlamo = GlamoTestInit(0);
+    TestSurface surfaces[3];
+    static const int pairs[][2] = { { 0, 1 }, { 1, 1 }, { 2, 2 } };
+    int alu, i, n, sx, sy, dx, dy, w, h;
+
+    pGlamo->sim_latency = latency;
+    SurfaceInit(&surfaces[0], TEST_WIDTH + 36, TEST_HEIGHT + 16);
+    SurfaceInit(&surfaces[1], TEST_WIDTH + 36, TEST_HEIGHT + 16);
+    SurfaceInit(&surfaces[2], TEST_TALL_WIDTH, TEST_TALL_HEIGHT);
+
+    for (alu = 0; alu < 16; alu++) {
+        for (i = 0; i < 3; i++) {
+            TestSurface *src = &surfaces[pairs[i][0]];
+            TestSurface *dst = &surfaces[pairs[i][1]];
+
+            if (!pGlamo->exa->PrepareCopy(src->pPix, dst->pPix, 1, 1,
+                                          alu, ~0)) {
+                GLAMO_TEST_CHECK(FALSE, "copy, alu %d: declined", alu);
+                continue;
+            }
+            for (n = 0; n < TEST_RECTS; n++) {
+                RandomSize(dst, &w, &h);
+                RandomPlace(src, w, h, &sx, &sy);
+                RandomPlace(dst, w, h, &dx, &dy);
+                pGlamo->exa->Copy(dst->pPix, sx, sy, dx, dy, w, h);
+                RefCopy(src, dst, alu, sx, sy, dx, dy, w, h);
+            }
+            pGlamo->exa->DoneCopy(dst->pPix);
+
+            SurfaceCheck(dst, src == dst ? "overlapping copy" : "copy", alu);
+        }
+    }
+
+    for (i = 0; i < 3; i++)
+        SurfaceFini(&surfaces[i]);
+    GlamoTestFini();
+}
+
+static void
+FillRows(GlamoPtr pGlamo, PixmapPtr pPix, CARD16 color)
+{
+    int y;
+
+    pGlamo->exa->PrepareSolid(pPix, GXcopy, ~0, color);
+    for (y = 0; y < pPix->drawable.height; y++)
+        pGlamo->exa->Solid(pPix, 0, y, pPix->drawable.width, y + 1);
+    pGlamo->exa->DoneSolid(pPix);
+}
+
+/* A fill one row at a time is dispatched in its middle, while the engine
+ * is busy with an earlier part of it.  An upload to the rows it fills
+ * last must not be overwritten by them afterwards. */
+static void
+TestUploadAfterKick(Bool staging)
+{
+    GlamoPtr pGlamo = GlamoTestInit(TEST_BATCH_SIZE);
+    PixmapPtr pPix = GlamoTestPixmap(TEST_WIDTH, TEST_HEIGHT);
+    CARD16 src[TEST_WIDTH];
+    unsigned long submissions;
+    int x;
+
+    if (!staging)
+        pGlamo->staging_size = 0;
+    pGlamo->sim_latency = TEST_SIM_LATENCY;
+
+    for (x = 0; x < TEST_WIDTH; x++)
+        src[x] = 0x1000 + x;
+
+    submissions = pGlamo->stats.submissions;
+    FillRows(pGlamo, pPix, 0xf800);
+    GLAMO_TEST_CHECK(pGlamo->stats.submissions > submissions,
+                     "the fill was not dispatched while it was queued");
+
+    pGlamo->exa->UploadToScreen(pPix, 0, TEST_HEIGHT - 1, TEST_WIDTH, 1,
+                                (char *)src, sizeof(src));
+    GlamoTestSync();
+
+    for (x = 0; x < TEST_WIDTH; x++) {
+        CARD16 p = GLAMO_TEST_PIXEL(pPix, x, TEST_HEIGHT - 1);
+
+        GLAMO_TEST_CHECK(p == src[x],
+                         "upload%s: pixel %d is 0x%04x, not 0x%04x",
+                         staging ? " through staging" : "", x, p, src[x]);
+    }
+    GLAMO_TEST_CHECK(GLAMO_TEST_PIXEL(pPix, 0, 0) == 0xf800,
+                     "the fill did not reach the first row");
+
+    GlamoTestFini();
+}
+
+/* The same, with the last rows read back instead */
+static void
+TestDownloadAfterKick(void)
+{
+    GlamoPtr pGlamo = GlamoTestInit(TEST_BATCH_SIZE);
+    PixmapPtr pPix = GlamoTestPixmap(TEST_WIDTH, TEST_HEIGHT);
+    CARD16 dst[TEST_WIDTH];
+    int x;
+
+    pGlamo->sim_latency = TEST_SIM_LATENCY;
+
+    FillRows(pGlamo, pPix, 0x07e0);
+
+    memset(dst, 0, sizeof(dst));
+    pGlamo->exa->DownloadFromScreen(pPix, 0, TEST_HEIGHT - 1, TEST_WIDTH, 1,
+                                    (char *)dst, sizeof(dst));
+
+    for (x = 0; x < TEST_WIDTH; x++) {
+        GLAMO_TEST_CHECK(dst[x] == 0x07e0,
+                         "download: pixel %d is 0x%04x, not 0x07e0",
+                         x, dst[x]);
+    }
+
+    GlamoTestFini();
+}
+
+/* A batch of commands, with the relocations of its addresses if it has
+ * any */
+typedef struct {
+    CARD16 cmds[TEST_PP_MAX_COUNT];
+    int count;
+    uint32_t handles[TEST_PP_MAX_RELOCS];
+    unsigned int obj_pos[TEST_PP_MAX_RELOCS];
+    int nrelocs;
+} TestBatch;
+
+/* The registers the batches write, and leave behind */
+static const CARD16 batch_regs[] = {
+    GLAMO_REG_2D_SRC_ADDRL, GLAMO_REG_2D_SRC_ADDRH, GLAMO_REG_2D_SRC_PITCH,
+    GLAMO_REG_2D_SRC_X, GLAMO_REG_2D_SRC_Y,
+    GLAMO_REG_2D_DST_ADDRL, GLAMO_REG_2D_DST_ADDRH, GLAMO_REG_2D_DST_PITCH,
+    GLAMO_REG_2D_DST_HEIGHT, GLAMO_REG_2D_DST_X, GLAMO_REG_2D_DST_Y,
+    GLAMO_REG_2D_RECT_WIDTH, GLAMO_REG_2D_RECT_HEIGHT,
+    GLAMO_REG_2D_PAT_FG, GLAMO_REG_2D_COMMAND2,
+    GLAMO_REG_2D_ID1, GLAMO_REG_2D_ID2,
+};
+
+#define BATCH_NUM_REGS (sizeof(batch_regs) / sizeof(batch_regs[0]))
+
+/* The relocation handle of each surface */
+#define TEST_PP_HANDLE(i)	(0x100 + (i))
+
+static void
+BatchOut(TestBatch *b, CARD16 reg, CARD16 val)
+{
+    b->cmds[b->count++] = reg;
+    b->cmds[b->count++] = val;
+}
+
+/* The address of a surface, as the driver writes it with and without
+ * relocations */
+static void
+BatchOutAddr(TestBatch *b, CARD16 reg, TestSurface *surfaces, int i,
+             Bool relocs)
+{
+    unsigned long offset = exaGetPixmapOffset(surfaces[i].pPix);
+
+    if (relocs) {
+        b->handles[b->nrelocs] = TEST_PP_HANDLE(i);
+        b->obj_pos[b->nrelocs] = b->count * 2;
+        b->nrelocs++;
+        offset = 0;
+    }
+
+    BatchOut(b, reg, offset & 0xffff);
+    BatchOut(b, reg + 2, (offset >> 16) & 0x7f);
+}
+
+static int
+RandomGrid(int size)
+{
+    return TEST_PP_GRID * (rand() % (size / TEST_PP_GRID));
+}
+
+/* A random batch of fills and copies, each new state set up in full like
+ * the driver's Prepare hooks do, with a register written again now and
+ * then for the pass to leave out */
+static void
+RandomBatch(TestBatch *b, TestSurface *surfaces, Bool relocs)
+{
+    static const CARD8 fill_rops[] = { 0xf0, 0x5a, 0x00, 0xff };
+    static const CARD8 copy_rops[] = { 0xcc, 0x66, 0x88 };
+    static const CARD16 patterns[] = { 0xf800, 0x07e0 };
+    PixmapPtr pDst = NULL;
+    Bool copy = FALSE;
+    int n, src, dst, w, h;
+
+    b->count = 0;
+    b->nrelocs = 0;
+
+    for (n = 0; n < TEST_PP_BLITS; n++) {
+        if (!pDst || rand() % 4 == 0) {
+            copy = rand() % 2;
+            dst = rand() % TEST_PP_SURFACES;
+            pDst = surfaces[dst].pPix;
+
+            if (copy) {
+                src = rand() % TEST_PP_SURFACES;
+                BatchOutAddr(b, GLAMO_REG_2D_SRC_ADDRL, surfaces, src, relocs);
+                BatchOut(b, GLAMO_REG_2D_SRC_PITCH,
+                         surfaces[src].pPix->devKind & 0x7ff);
+            }
+            BatchOutAddr(b, GLAMO_REG_2D_DST_ADDRL, surfaces, dst, relocs);
+            BatchOut(b, GLAMO_REG_2D_DST_PITCH, pDst->devKind & 0x7ff);
+            BatchOut(b, GLAMO_REG_2D_DST_HEIGHT, pDst->drawable.height);
+            if (copy) {
+                BatchOut(b, GLAMO_REG_2D_COMMAND2,
+                         copy_rops[rand() % sizeof(copy_rops)] << 8);
+            } else {
+                BatchOut(b, GLAMO_REG_2D_PAT_FG, patterns[rand() % 2]);
+                BatchOut(b, GLAMO_REG_2D_COMMAND2,
+                         fill_rops[rand() % sizeof(fill_rops)] << 8);
+            }
+            BatchOut(b, GLAMO_REG_2D_ID1, 0);
+            BatchOut(b, GLAMO_REG_2D_ID2, 0);
+        } else if (rand() % 4 == 0) {
+            BatchOut(b, GLAMO_REG_2D_DST_PITCH, pDst->devKind & 0x7ff);
+        }
+
+        w = TEST_PP_GRID + RandomGrid(pDst->drawable.width / 2);
+        h = TEST_PP_GRID + RandomGrid(pDst->drawable.height / 2);
+        if (copy) {
+            BatchOut(b, GLAMO_REG_2D_SRC_X, RandomGrid(TEST_WIDTH - w + 1));
+            BatchOut(b, GLAMO_REG_2D_SRC_Y, RandomGrid(TEST_HEIGHT - h + 1));
+        }
+        BatchOut(b, GLAMO_REG_2D_DST_X,
+                 RandomGrid(pDst->drawable.width - w + 1));
+        BatchOut(b, GLAMO_REG_2D_DST_Y,
+                 RandomGrid(pDst->drawable.height - h + 1));
+        BatchOut(b, GLAMO_REG_2D_RECT_WIDTH, w);
+        BatchOut(b, GLAMO_REG_2D_RECT_HEIGHT, h);
+        BatchOut(b, GLAMO_REG_2D_COMMAND3, 0);
+    }
+}
+
+/* Fill in the addresses of relocated buffers, as the kernel does.  The
+ * relocations are of handles[map[i]], or handles[i] without a map. */
+static void
+BatchRelocate(CARD16 *cmds, const unsigned int *obj_pos, int nrelocs,
+              const uint32_t *handles, const int *map,
+              TestSurface *surfaces)
+{
+    unsigned long offset;
+    int i, h;
+
+    for (i = 0; i < nrelocs; i++) {
+        h = handles[map ? map[i] : i];
+        offset = exaGetPixmapOffset(surfaces[h - TEST_PP_HANDLE(0)].pPix);
+        cmds[obj_pos[i] / 2 + 1] = offset & 0xffff;
+        cmds[obj_pos[i] / 2 + 3] = (offset >> 16) & 0x7f;
+    }
+}
+
+/* Run commands on the engine, starting from cleared registers */
+static void
+BatchRun(GlamoPtr pGlamo, const CARD16 *cmds, int count)
+{
+    MemBuf *buf = pGlamo->cmd_queue;
+    int i;
+
+    for (i = 0; i < BATCH_NUM_REGS; i++)
+        MMIO_OUT16(pGlamo->reg_base, batch_regs[i], 0);
+
+    memcpy(buf->data, cmds, count * 2);
+    buf->used = count * 2;
+    GLAMODispatchCMDQ(pGlamo);
+    GlamoTestSync();
+}
+
+/* Random batches, run as they are and through the peephole pass, from the
+ * same pixels.  Without relocations, GLAMODispatchCMDQ() runs the pass;
+ * with them, it runs here and the relocations it keeps are applied. */
+static void
+TestPeephole(Bool relocs)
+{
+    GlamoPtr pGlamo = GlamoTestInit(0);
+    TestSurface surfaces[TEST_PP_SURFACES];
+    static TestBatch batch;
+    static CARD16 cmds[TEST_PP_MAX_COUNT];
+    unsigned int obj_pos[TEST_PP_MAX_RELOCS];
+    int map[TEST_PP_MAX_RELOCS];
+    CARD16 regs[BATCH_NUM_REGS];
+    CARD8 *start, *end, *before, *after;
+    unsigned long long saved;
+    int i, n, count, nrelocs;
+    size_t size;
+
+    for (i = 0; i < TEST_PP_SURFACES; i++)
+        SurfaceInit(&surfaces[i], TEST_WIDTH, TEST_HEIGHT);
+    start = surfaces[0].pPix->devPrivate.ptr;
+    end = (CARD8 *)surfaces[TEST_PP_SURFACES - 1].pPix->devPrivate.ptr +
+          TEST_WIDTH * 2 * TEST_HEIGHT;
+    size = end - start;
+    before = malloc(size);
+    after = malloc(size);
+    if (!before || !after)
+        exit(1);
+
+    saved = pGlamo->stats.peephole_saved;
+
+    for (n = 0; n < TEST_PP_BATCHES; n++) {
+        RandomBatch(&batch, surfaces, relocs);
+        memcpy(before, start, size);
+
+        memcpy(cmds, batch.cmds, batch.count * 2);
+        BatchRelocate(cmds, batch.obj_pos, batch.nrelocs, batch.handles,
+                      NULL, surfaces);
+        pGlamo->peephole = FALSE;
+        BatchRun(pGlamo, cmds, batch.count);
+        memcpy(after, start, size);
+        for (i = 0; i < BATCH_NUM_REGS; i++)
+            regs[i] = MMIO_IN16(pGlamo->reg_base, batch_regs[i]);
+
+        memcpy(start, before, size);
+        memcpy(cmds, batch.cmds, batch.count * 2);
+        count = batch.count;
+        if (relocs) {
+            memcpy(obj_pos, batch.obj_pos, sizeof(obj_pos));
+            nrelocs = batch.nrelocs;
+            count = GlamoPeepholeRun(pGlamo, cmds, count, batch.handles,
+                                     obj_pos, &nrelocs, map);
+            BatchRelocate(cmds, obj_pos, nrelocs, batch.handles,
+                          count == batch.count ? NULL : map, surfaces);
+        } else {
+            pGlamo->peephole = TRUE;
+        }
+        BatchRun(pGlamo, cmds, count);
+
+        GLAMO_TEST_CHECK(memcmp(start, after, size) == 0,
+                         "peephole%s, batch %d: the pixels differ",
+                         relocs ? " with relocations" : "", n);
+        for (i = 0; i < BATCH_NUM_REGS; i++) {
+            CARD16 r = MMIO_IN16(pGlamo->reg_base, batch_regs[i]);
+
+            GLAMO_TEST_CHECK(r == regs[i], "peephole%s, batch %d: register "
+                             "0x%04x is 0x%04x, not 0x%04x",
+                             relocs ? " with relocations" : "", n,
+                             batch_regs[i], r, regs[i]);
+        }
+    }
+
+    GLAMO_TEST_CHECK(pGlamo->stats.peephole_saved > saved,
+                     "peephole%s: no batch was shortened",
+                     relocs ? " with relocations" : "");
+
+    free(before);
+    free(after);
+    for (i = 0; i < TEST_PP_SURFACES; i++)
+        SurfaceFini(&surfaces[i]);
+    GlamoPeepholeFini();
+    GlamoTestFini();
+}
+
+int
+main(int argc, char **argv)
+{
+    srand(1);
+
+    TestFills(0);
+    TestFills(3);
+    TestCopies(0);
+    TestCopies(3);
+    TestUploadAfterKick(FALSE);
+    TestUploadAfterKick(TRUE);
+    TestDownloadAfterKick();
+    TestPeephole(FALSE);
+    TestPeephole(TRUE);
+
+    if (glamo_test_failures) {
+        fprintf(stderr, "%d checks failed\n", glamo_test_failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,346 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Run the submission thread (glamo-submit.c) with a stand-in for the
+ * kernel, which can be held back, and check that the X thread waits when
+ * every slot is queued, that command buffers reach the kernel intact and
+ * in order, that failures are counted, and that destroying the queue
+ * submits everything queued and drops its references.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "glamo.h"
+#include "glamo-drm.h"
+#include "glamo-submit.h"
+#include "glamo-test.h"
+
+#define TEST_CMD_BYTES		64
+#define TEST_OBJS		4
+#define TEST_SUBMISSIONS	32
+
+/* How long the opener lets the X thread sit in GlamoSubmitQueue() */
+#define TEST_HOLD_USEC		50000
+
+int glamo_test_failures;
+
+/* The kernel: it takes each submission once the gate is open, fails those
+ * whose second command word is set, and notes what it was given */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t opened;
+    Bool open;
+    int delay;				/* microseconds per submission */
+    unsigned int seqs[TEST_SUBMISSIONS];
+    int count;
+    int corrupt;			/* cmds not matching seq */
+} kernel = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+};
+
+/* Stand-ins for buffer objects, which only the X thread unreferences */
+static char bos[TEST_SUBMISSIONS * TEST_OBJS];
+static int unrefs[TEST_SUBMISSIONS * TEST_OBJS];
+
+void
+glamo_bo_unref(struct glamo_bo *bo)
+{
+    unrefs[(char *)bo - bos]++;
+}
+
+static int
+TestSubmit(void *data, struct glamo_submission *sub)
+{
+    int ret;
+
+    pthread_mutex_lock(&kernel.lock);
+    while (!kernel.open)
+        pthread_cond_wait(&kernel.opened, &kernel.lock);
+    pthread_mutex_unlock(&kernel.lock);
+
+    if (kernel.delay)
+        usleep(kernel.delay);
+
+    pthread_mutex_lock(&kernel.lock);
+    if (sub->cmd_bytes != TEST_CMD_BYTES ||
+        sub->cmds[0] != (uint16_t)sub->seq)
+        kernel.corrupt++;
+    if (kernel.count < TEST_SUBMISSIONS)
+        kernel.seqs[kernel.count] = sub->seq;
+    kernel.count++;
+    ret = sub->cmds[1] ? -EIO : 0;
+    pthread_mutex_unlock(&kernel.lock);
+
+    return ret;
+}
+
+static void
+SetGate(Bool open)
+{
+    pthread_mutex_lock(&kernel.lock);
+    kernel.open = open;
+    pthread_cond_broadcast(&kernel.opened);
+    pthread_mutex_unlock(&kernel.lock);
+}
+
+static void *
+OpenGateLater(void *arg)
+{
+    usleep(TEST_HOLD_USEC);
+    SetGate(TRUE);
+
+    return NULL;
+}
+
+static int
+KernelCount(void)
+{
+    int count;
+
+    pthread_mutex_lock(&kernel.lock);
+    count = kernel.count;
+    pthread_mutex_unlock(&kernel.lock);
+
+    return count;
+}
+
+static struct glamo_submit_queue *
+TestCreate(Bool open, int delay)
+{
+    struct glamo_submit_queue *q;
+
+    kernel.open = open;
+    kernel.delay = delay;
+    kernel.count = 0;
+    kernel.corrupt = 0;
+    memset(unrefs, 0, sizeof(unrefs));
+
+    q = GlamoSubmitCreate(TestSubmit, NULL, TEST_CMD_BYTES, TEST_OBJS);
+    if (!q) {
+        fprintf(stderr, "Failed to create the submission queue\n");
+        exit(1);
+    }
+
+    return q;
+}
+
+/* Fill the current slot as submission n, referencing nobjs buffers, and
+ * queue it */
+static Bool
+TestQueue(struct glamo_submit_queue *q, int n, int nobjs, Bool fail)
+{
+    struct glamo_submission *sub = GlamoSubmitCurrent(q);
+    int i;
+
+    memset(sub->cmds, 0, TEST_CMD_BYTES);
+    sub->cmds[0] = n + 1;
+    sub->cmds[1] = fail;
+    sub->cmd_bytes = TEST_CMD_BYTES;
+    for (i = 0; i < nobjs; i++) {
+        sub->objs[i] = n * TEST_OBJS + i;
+        sub->obj_pos[i] = i * 4;
+        sub->bos[i] = (struct glamo_bo *)&bos[n * TEST_OBJS + i];
+    }
+    sub->nobjs = nobjs;
+    sub->seq = n + 1;
+
+    return GlamoSubmitQueue(q);
+}
+
+/* The submissions the kernel got should be the first count, in order */
+static void
+CheckKernel(const char *test, int count)
+{
+    int i;
+
+    GLAMO_TEST_CHECK(kernel.count == count,
+                     "%s: %d submissions made, not %d",
+                     test, kernel.count, count);
+    GLAMO_TEST_CHECK(kernel.corrupt == 0,
+                     "%s: %d command buffers changed while queued",
+                     test, kernel.corrupt);
+
+    for (i = 0; i < kernel.count && i < count; i++) {
+        GLAMO_TEST_CHECK(kernel.seqs[i] == i + 1,
+                         "%s: submission %d was fence %u, not %d",
+                         test, i, kernel.seqs[i], i + 1);
+    }
+}
+
+static void
+CheckUnrefs(const char *test, int count, int nobjs)
+{
+    int i;
+
+    for (i = 0; i < count * TEST_OBJS; i++) {
+        int expect = i % TEST_OBJS < nobjs;
+
+        GLAMO_TEST_CHECK(unrefs[i] == expect,
+                         "%s: buffer %d of submission %d unreferenced "
+                         "%d times, not %d",
+                         test, i % TEST_OBJS, i / TEST_OBJS,
+                         unrefs[i], expect);
+    }
+}
+
+/* With the kernel held back, all but the slot being filled can be queued
+ * without waiting; queueing that one too must wait for the thread */
+static void
+TestBackPressure(void)
+{
+    struct glamo_submit_queue *q;
+    pthread_t opener;
+    int i;
+
+    q = TestCreate(FALSE, 0);
+
+    for (i = 0; i < GLAMO_SUBMIT_SLOTS - 1; i++) {
+        GLAMO_TEST_CHECK(TestQueue(q, i, 1, FALSE),
+                         "back-pressure: waited to queue submission %d "
+                         "of %d", i, GLAMO_SUBMIT_SLOTS - 1);
+    }
+    GLAMO_TEST_CHECK(KernelCount() == 0,
+                     "back-pressure: submitted through a closed gate");
+
+    pthread_create(&opener, NULL, OpenGateLater, NULL);
+    GLAMO_TEST_CHECK(!TestQueue(q, i, 1, FALSE),
+                     "back-pressure: didn't wait with every slot queued");
+    GLAMO_TEST_CHECK(KernelCount() >= 1,
+                     "back-pressure: returned before a slot was free");
+    GLAMO_TEST_CHECK(unrefs[0] == 1,
+                     "back-pressure: the submitted slot wasn't reclaimed");
+    pthread_join(opener, NULL);
+
+    GlamoSubmitDestroy(q);
+
+    CheckKernel("back-pressure", GLAMO_SUBMIT_SLOTS);
+    CheckUnrefs("back-pressure", GLAMO_SUBMIT_SLOTS, 1);
+}
+
+/* GlamoSubmitWait() returns once the fence asked for has been submitted,
+ * which means everything before it has been too */
+static void
+TestWait(void)
+{
+    struct glamo_submit_queue *q;
+    int i;
+
+    q = TestCreate(TRUE, 1000);
+
+    for (i = 0; i < TEST_SUBMISSIONS; i++) {
+        TestQueue(q, i, 0, FALSE);
+        if (i % 5 == 2) {
+            GlamoSubmitWait(q, i + 1);
+            GLAMO_TEST_CHECK(KernelCount() >= i + 1,
+                             "wait: returned from waiting for fence %d "
+                             "with %d submitted", i + 1, KernelCount());
+        }
+    }
+
+    GlamoSubmitWait(q, TEST_SUBMISSIONS);
+    GLAMO_TEST_CHECK(KernelCount() == TEST_SUBMISSIONS,
+                     "wait: returned from waiting for the last fence with "
+                     "%d of %d submitted", KernelCount(), TEST_SUBMISSIONS);
+
+    /* and at once for a fence already submitted */
+    GlamoSubmitWait(q, 1);
+
+    GlamoSubmitDestroy(q);
+
+    CheckKernel("wait", TEST_SUBMISSIONS);
+}
+
+/* Failed submissions are counted, and still count as submitted */
+static void
+TestErrors(void)
+{
+    struct glamo_submit_queue *q;
+    unsigned int errors = 0;
+    int i;
+
+    q = TestCreate(TRUE, 0);
+
+    for (i = 0; i < TEST_SUBMISSIONS; i++) {
+        Bool fail = i % 3 == 1;
+
+        TestQueue(q, i, 0, fail);
+        errors += fail;
+    }
+
+    GlamoSubmitWait(q, TEST_SUBMISSIONS);
+    GLAMO_TEST_CHECK(q->errors == errors,
+                     "errors: %u failed submissions counted, not %u",
+                     q->errors, errors);
+
+    GlamoSubmitDestroy(q);
+
+    CheckKernel("errors", TEST_SUBMISSIONS);
+}
+
+/* Destroying the queue waits for the kernel to take everything queued, and
+ * drops the references the thread was holding */
+static void
+TestDestroy(void)
+{
+    struct glamo_submit_queue *q;
+    pthread_t opener;
+    int i;
+
+    q = TestCreate(FALSE, 1000);
+
+    for (i = 0; i < GLAMO_SUBMIT_SLOTS - 1; i++)
+        TestQueue(q, i, TEST_OBJS, FALSE);
+
+    pthread_create(&opener, NULL, OpenGateLater, NULL);
+    GlamoSubmitDestroy(q);
+    pthread_join(opener, NULL);
+
+    CheckKernel("destroy", GLAMO_SUBMIT_SLOTS - 1);
+    CheckUnrefs("destroy", GLAMO_SUBMIT_SLOTS - 1, TEST_OBJS);
+}
+
+int
+main(int argc, char **argv)
+{
+    TestBackPressure();
+    TestWait();
+    TestErrors();
+    TestDestroy();
+
+    if (glamo_test_failures) {
+        fprintf(stderr, "%d checks failed\n", glamo_test_failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "scrnintstr.h"
+#include "pixmapstr.h"
+#include "windowstr.h"
+#include "property.h"
+
+#include "glamo.h"
+#include "glamo-cmdq.h"
+#include "glamo-render.h"
+#include "glamo-sim.h"
+#include "glamo-test.h"
+
+#define GLAMO_TEST_MAX_PIXMAPS 64
+
+int glamo_test_failures;
+
+static ScrnInfoPtr screens[1];
+static GlamoPtr pGlamo;
+static PixmapPtr pixmaps[GLAMO_TEST_MAX_PIXMAPS];
+static int num_pixmaps;
+static size_t next_offset;
+
+/*
+ * The parts of the X server the acceleration code calls
+ */
+
+ScrnInfoPtr *xf86Screens;
+ClientPtr serverClient;
+
+void
+xf86DrvMsg(int scrnIndex, MessageType type, const char *format, ...)
+{
+    va_list args;
+
+    if (type != X_ERROR)
+        return;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+void
+ErrorF(const char *format, ...)
+{
+}
+
+Bool
+RegisterBlockAndWakeupHandlers(BlockHandlerProcPtr blockHandler,
+                               WakeupHandlerProcPtr wakeupHandler,
+                               pointer blockData)
+{
+    return TRUE;
+}
+
+void
+RemoveBlockAndWakeupHandlers(BlockHandlerProcPtr blockHandler,
+                             WakeupHandlerProcPtr wakeupHandler,
+                             pointer blockData)
+{
+}
+
+void
+NoopDDA(void)
+{
+}
+
+CARD32
+GetTimeInMillis(void)
+{
+    return GlamoStatsTime() / 1000;
+}
+
+Atom
+MakeAtom(const char *string, unsigned len, Bool makeit)
+{
+    return None;
+}
+
+int
+dixChangeWindowProperty(ClientPtr pClient, WindowPtr pWin, Atom property,
+                        Atom type, int format, int mode, unsigned long len,
+                        pointer value, Bool sendevent)
+{
+    return Success;
+}
+
+OsSigHandlerPtr
+OsSignal(int sig, OsSigHandlerPtr handler)
+{
+    return NULL;
+}
+
+ExaDriverPtr
+exaDriverAlloc(void)
+{
+    return calloc(1, sizeof(ExaDriverRec));
+}
+
+Bool
+exaDriverInit(ScreenPtr pScreen, ExaDriverPtr pScreenInfo)
+{
+    return TRUE;
+}
+
+void
+exaDriverFini(ScreenPtr pScreen)
+{
+}
+
+void
+exaMarkSync(ScreenPtr pScreen)
+{
+}
+
+void
+exaWaitSync(ScreenPtr pScreen)
+{
+    GlamoTestSync();
+}
+
+unsigned long
+exaGetPixmapOffset(PixmapPtr pPix)
+{
+    return (CARD8 *)pPix->devPrivate.ptr - pGlamo->exa->memoryBase;
+}
+
+unsigned long
+exaGetPixmapPitch(PixmapPtr pPix)
+{
+    return pPix->devKind;
+}
+
+/* Render is left to software */
+
+enum glamo_composite
+GLAMOCompositeCheck(int op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
+                    PicturePtr pDstPicture)
+{
+    return GLAMO_COMPOSITE_NONE;
+}
+
+Bool
+GLAMOCompositeFill(int op, PicturePtr pSrcPicture, CARD32 pixel, Pixel *fill)
+{
+    return FALSE;
+}
+
+void
+GLAMORenderInit(ScreenPtr pScreen)
+{
+}
+
+void
+GLAMORenderFini(ScreenPtr pScreen)
+{
+}
+
+/*
+ * The screen
+ */
+
+GlamoPtr
+GlamoTestInit(size_t batch_size)
+{
+    ScrnInfoPtr pScrn;
+
+    pScrn = calloc(1, sizeof(ScrnInfoRec));
+    pGlamo = calloc(1, sizeof(GlamoRec));
+    if (!pScrn || !pGlamo)
+        goto fail;
+    pScrn->driverPrivate = pGlamo;
+    screens[0] = pScrn;
+    xf86Screens = screens;
+
+    pGlamo->pScreen = calloc(1, sizeof(ScreenRec));
+    pGlamo->fbstart = calloc(1, GLAMO_TEST_VRAM_SIZE);
+    if (!pGlamo->pScreen || !pGlamo->fbstart)
+        goto fail;
+    pScrn->pScreen = pGlamo->pScreen;
+
+    pGlamo->fb_fix.smem_len = GLAMO_TEST_VRAM_SIZE;
+    pGlamo->accel = TRUE;
+    pGlamo->sim = TRUE;
+    pGlamo->capture_fd = -1;
+    pGlamo->batch_size = batch_size ? batch_size : GLAMO_CMDQ_DEFAULT_BATCH;
+
+    if (!GLAMOSimInit(pScrn) ||
+        !GLAMODrawInit(pScrn, GLAMO_TEST_FRONT_SIZE,
+                       GLAMO_TEST_VRAM_SIZE - GLAMO_TEST_FRONT_SIZE) ||
+        !GLAMODrawEnable(pScrn))
+        goto fail;
+
+    next_offset = pGlamo->exa->offScreenBase;
+
+    return pGlamo;
+
+fail:
+    fprintf(stderr, "Failed to set up the simulated glamo\n");
+    exit(1);
+}
+
+void
+GlamoTestFini(void)
+{
+    ScrnInfoPtr pScrn = screens[0];
+
+    while (num_pixmaps)
+        free(pixmaps[--num_pixmaps]);
+
+    GLAMODrawDisable(pScrn);
+    GLAMODrawFini(pScrn);
+    GLAMOSimFini(pScrn);
+
+    free(pGlamo->fbstart);
+    free(pGlamo->pScreen);
+    free(pGlamo);
+    free(pScrn);
+    pGlamo = NULL;
+    screens[0] = NULL;
+}
+
+PixmapPtr
+GlamoTestPixmap(int width, int height)
+{
+    PixmapPtr pPix;
+    int pitch = width * 2;
+
+    next_offset = (next_offset + 31) & ~31;
+    if (num_pixmaps == GLAMO_TEST_MAX_PIXMAPS ||
+        next_offset + (size_t)pitch * height > pGlamo->staging_start) {
+        fprintf(stderr, "No room for a %dx%d pixmap\n", width, height);
+        exit(1);
+    }
+
+    pPix = calloc(1, sizeof(PixmapRec));
+    if (!pPix)
+        exit(1);
+
+    pPix->drawable.pScreen = pGlamo->pScreen;
+    pPix->drawable.width = width;
+    pPix->drawable.height = height;
+    pPix->drawable.depth = 16;
+    pPix->drawable.bitsPerPixel = 16;
+    pPix->refcnt = 1;
+    pPix->devKind = pitch;
+    pPix->devPrivate.ptr = pGlamo->exa->memoryBase + next_offset;
+
+    next_offset += (size_t)pitch * height;
+    pixmaps[num_pixmaps++] = pPix;
+
+    return pPix;
+}
+
+void
+GlamoTestSync(void)
+{
+    pGlamo->exa->WaitMarker(pGlamo->pScreen, 0);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef _GLAMO_TEST_H_
+#define _GLAMO_TEST_H_
+
+#include "glamo.h"
+
+/*
+ * The framebuffer acceleration code running on the simulated glamo
+ * (glamo-sim.c), with just enough of the X server around it to call it the
+ * way EXA does.
+ */
+
+/* Video memory, and how much of it is the visible screen */
+#define GLAMO_TEST_VRAM_SIZE	(2 * 1024 * 1024)
+#define GLAMO_TEST_FRONT_SIZE	(480 * 640 * 2)
+
+/* Set up the screen, with commands dispatched when batch_size bytes are
+ * queued (0 for the default), and return the driver state */
+GlamoPtr
+GlamoTestInit(size_t batch_size);
+
+void
+GlamoTestFini(void);
+
+/* A 16bpp pixmap in video memory, allocated after the previous ones until
+ * GlamoTestFini() */
+PixmapPtr
+GlamoTestPixmap(int width, int height);
+
+/* Let the engine finish everything queued, as EXA does before the CPU
+ * touches video memory */
+void
+GlamoTestSync(void);
+
+#define GLAMO_TEST_PIXEL(pPix, x, y)					\
+	(((CARD16 *)((CARD8 *)(pPix)->devPrivate.ptr +			\
+		     (y) * (pPix)->devKind))[x])
+
+/* Count a failed check, and say which */
+#define GLAMO_TEST_CHECK(cond, ...) do {				\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);		\
+		fprintf(stderr, __VA_ARGS__);				\
+		fprintf(stderr, "\n");					\
+		glamo_test_failures++;					\
+	}								\
+} while (0)
+
+extern int glamo_test_failures;
+
+#endif /* _GLAMO_TEST_H_ */
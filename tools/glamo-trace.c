@@ -0,0 +1,373 @@
+/*
+ * Copyright © 2010 OpenMoko, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Replay a command stream captured with Option "CaptureFile" (or
+ * GLAMO_CAPTURE) through a model of the register file, and report where the
+ * command bandwidth goes: writes per register, writes which don't change the
+ * register, bytes per 2D operation and the sizes of the submissions.
+ *
+ * The trace does not contain the contents of video memory, so only the
+ * register state is replayed, not the pixels.
+ *
+ * usage: glamo-trace [-d] trace-file
+ *   -d  print every register write while replaying
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define GLAMO_CAPTURE_FORMAT_ONLY
+#include "glamo-capture.h"
+#include "glamo-regs.h"
+
+#define NUM_REGS (0x2400 / 2)
+#define NUM_SIZE_BUCKETS 16
+
+static const struct {
+    uint16_t reg;
+    const char *name;
+} reg_names[] = {
+    { GLAMO_REG_2D_SRC_ADDRL, "2D_SRC_ADDRL" },
+    { GLAMO_REG_2D_SRC_ADDRH, "2D_SRC_ADDRH" },
+    { GLAMO_REG_2D_SRC_PITCH, "2D_SRC_PITCH" },
+    { GLAMO_REG_2D_SRC_X, "2D_SRC_X" },
+    { GLAMO_REG_2D_SRC_Y, "2D_SRC_Y" },
+    { GLAMO_REG_2D_DST_X, "2D_DST_X" },
+    { GLAMO_REG_2D_DST_Y, "2D_DST_Y" },
+    { GLAMO_REG_2D_DST_ADDRL, "2D_DST_ADDRL" },
+    { GLAMO_REG_2D_DST_ADDRH, "2D_DST_ADDRH" },
+    { GLAMO_REG_2D_DST_PITCH, "2D_DST_PITCH" },
+    { GLAMO_REG_2D_DST_HEIGHT, "2D_DST_HEIGHT" },
+    { GLAMO_REG_2D_RECT_WIDTH, "2D_RECT_WIDTH" },
+    { GLAMO_REG_2D_RECT_HEIGHT, "2D_RECT_HEIGHT" },
+    { GLAMO_REG_2D_PAT_ADDRL, "2D_PAT_ADDRL" },
+    { GLAMO_REG_2D_PAT_ADDRH, "2D_PAT_ADDRH" },
+    { GLAMO_REG_2D_PAT_FG, "2D_PAT_FG" },
+    { GLAMO_REG_2D_PAT_BG, "2D_PAT_BG" },
+    { GLAMO_REG_2D_SRC_FG, "2D_SRC_FG" },
+    { GLAMO_REG_2D_SRC_BG, "2D_SRC_BG" },
+    { GLAMO_REG_2D_COMMAND1, "2D_COMMAND1" },
+    { GLAMO_REG_2D_COMMAND2, "2D_COMMAND2" },
+    { GLAMO_REG_2D_COMMAND3, "2D_COMMAND3" },
+    { GLAMO_REG_2D_ID1, "2D_ID1" },
+    { GLAMO_REG_2D_ID2, "2D_ID2" },
+    { GLAMO_REG_2D_ID3, "2D_ID3" },
+    { GLAMO_REG_ISP_EN1, "ISP_EN1" },
+};
+
+struct replay {
+    int dump;
+
+    /* Register model */
+    uint16_t regs[NUM_REGS];
+    unsigned char known[NUM_REGS];
+
+    /* Statistics */
+    unsigned long writes[NUM_REGS];
+    unsigned long redundant[NUM_REGS];
+    unsigned long submissions;
+    unsigned long long cmd_bytes;
+    unsigned long relocs;
+    unsigned long ops;
+    unsigned long long op_pixels;
+    unsigned long sizes[NUM_SIZE_BUCKETS];
+    double first_time, last_time;
+};
+
+static const char *
+reg_name(uint16_t reg)
+{
+    static char buf[8];
+    unsigned int i;
+
+    for (i = 0; i < sizeof(reg_names) / sizeof(reg_names[0]); i++) {
+        if (reg_names[i].reg == reg)
+            return reg_names[i].name;
+    }
+    snprintf(buf, sizeof(buf), "0x%04x", reg);
+    return buf;
+}
+
+static void
+replay_write(struct replay *r, uint16_t reg, uint16_t val, int reloc)
+{
+    unsigned int i = reg / 2;
+
+    if (i >= NUM_REGS)
+        return;
+
+    r->writes[i]++;
+
+    if (r->dump)
+        printf("  %-16s 0x%04x%s\n", reg_name(reg), val,
+               reloc ? " (relocated)" : "");
+
+    /* Relocated addresses are patched by the kernel, so we don't know what
+     * ends up in the register */
+    if (reloc) {
+        r->known[i] = 0;
+        return;
+    }
+
+    if (reg == GLAMO_REG_2D_COMMAND3) {
+        r->ops++;
+        r->op_pixels += (unsigned long long)
+                        r->regs[GLAMO_REG_2D_RECT_WIDTH / 2] *
+                        r->regs[GLAMO_REG_2D_RECT_HEIGHT / 2];
+    } else if (r->known[i] && r->regs[i] == val) {
+        r->redundant[i]++;
+    }
+
+    r->regs[i] = val;
+    r->known[i] = 1;
+}
+
+static void
+replay_record(struct replay *r, const uint16_t *cmds, size_t nwords,
+              const uint32_t *offsets, uint32_t nrelocs)
+{
+    unsigned char *is_reloc;
+    size_t i = 0;
+    uint32_t j;
+    uint16_t reg, val;
+    int n, reloc = 0;
+
+    is_reloc = calloc(nwords + 1, 1);
+    if (!is_reloc) {
+        perror("calloc");
+        exit(1);
+    }
+    for (j = 0; j < nrelocs; j++) {
+        if (offsets[j] / 2 < nwords)
+            is_reloc[offsets[j] / 2] = 1;
+    }
+
+    while (i + 1 < nwords) {
+        /* A relocation covers the low and high address words */
+        if (is_reloc[i])
+            reloc = 2;
+        reg = cmds[i++];
+        val = cmds[i++];
+        if (reg & (1 << 15)) {
+            reg &= 0x7fff;
+            for (n = val; n > 0 && i < nwords; n--) {
+                replay_write(r, reg, cmds[i++], 0);
+                reg += 2;
+            }
+        } else {
+            replay_write(r, reg, val, reloc > 0);
+        }
+        if (reloc > 0)
+            reloc--;
+    }
+
+    free(is_reloc);
+}
+
+static void
+report(struct replay *r, uint32_t source)
+{
+    unsigned long total_writes = 0, total_redundant = 0;
+    unsigned long best;
+    double span;
+    int i, j, bucket;
+
+    span = r->last_time - r->first_time;
+
+    printf("Source:            %s\n",
+           source == GLAMO_CAPTURE_SOURCE_DRM ? "DRM" : "MMIO ring");
+    printf("Submissions:       %lu in %.3f s", r->submissions, span);
+    if (span > 0)
+        printf(" (%.1f per second)", r->submissions / span);
+    printf("\n");
+    printf("Command bytes:     %llu", r->cmd_bytes);
+    if (r->submissions)
+        printf(" (%.1f per submission)",
+               (double)r->cmd_bytes / r->submissions);
+    printf("\n");
+    printf("Relocations:       %lu\n", r->relocs);
+    printf("2D operations:     %lu", r->ops);
+    if (r->ops)
+        printf(" (%.1f bytes and %.1f pixels per operation)",
+               (double)r->cmd_bytes / r->ops,
+               (double)r->op_pixels / r->ops);
+    printf("\n");
+
+    for (i = 0; i < NUM_REGS; i++) {
+        total_writes += r->writes[i];
+        total_redundant += r->redundant[i];
+    }
+    printf("Register writes:   %lu\n", total_writes);
+    printf("Redundant writes:  %lu", total_redundant);
+    if (total_writes)
+        printf(" (%.1f%%, %lu bytes)",
+               100.0 * total_redundant / total_writes,
+               total_redundant * 4);
+    printf("\n\n");
+
+    printf("Submission sizes:\n");
+    for (bucket = 0; bucket < NUM_SIZE_BUCKETS; bucket++) {
+        if (!r->sizes[bucket])
+            continue;
+        if (bucket == NUM_SIZE_BUCKETS - 1)
+            printf("  %6u +      bytes: %lu\n",
+                   1u << (bucket + 3), r->sizes[bucket]);
+        else
+            printf("  %6u - %6u bytes: %lu\n",
+                   bucket ? 1u << (bucket + 3) : 0,
+                   (1u << (bucket + 4)) - 1, r->sizes[bucket]);
+    }
+    printf("\n");
+
+    /* Registers, most written first */
+    printf("  %-16s %10s %10s\n", "Register", "Writes", "Redundant");
+    for (;;) {
+        j = -1;
+        best = 0;
+        for (i = 0; i < NUM_REGS; i++) {
+            if (r->writes[i] > best) {
+                best = r->writes[i];
+                j = i;
+            }
+        }
+        if (j < 0)
+            break;
+        printf("  %-16s %10lu %10lu\n", reg_name(j * 2),
+               r->writes[j], r->redundant[j]);
+        r->writes[j] = 0;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct glamo_capture_header header;
+    struct glamo_capture_record record;
+    struct replay *r;
+    uint16_t *cmds = NULL;
+    uint32_t *relocs = NULL;
+    size_t cmds_size = 0, relocs_size = 0;
+    double t;
+    int bucket;
+    FILE *fh;
+    int c;
+
+    r = calloc(1, sizeof(*r));
+    if (!r) {
+        perror("calloc");
+        return 1;
+    }
+
+    while ((c = getopt(argc, argv, "d")) != -1) {
+        switch (c) {
+            case 'd':
+                r->dump = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-d] trace-file\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-d] trace-file\n", argv[0]);
+        return 1;
+    }
+
+    fh = fopen(argv[optind], "rb");
+    if (!fh) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    if (fread(&header, sizeof(header), 1, fh) != 1
+            || header.magic != GLAMO_CAPTURE_MAGIC) {
+        fprintf(stderr, "%s: not a glamo command trace\n", argv[optind]);
+        return 1;
+    }
+    if (header.version != GLAMO_CAPTURE_VERSION) {
+        fprintf(stderr, "%s: unsupported trace version %u\n",
+                argv[optind], header.version);
+        return 1;
+    }
+
+    while (fread(&record, sizeof(record), 1, fh) == 1) {
+
+        if (record.cmd_bytes > cmds_size) {
+            cmds_size = record.cmd_bytes;
+            cmds = realloc(cmds, cmds_size);
+        }
+        if (record.nrelocs * 2 * sizeof(uint32_t) > relocs_size) {
+            relocs_size = record.nrelocs * 2 * sizeof(uint32_t);
+            relocs = realloc(relocs, relocs_size);
+        }
+        if ((record.cmd_bytes && !cmds) || (record.nrelocs && !relocs)) {
+            perror("realloc");
+            return 1;
+        }
+
+        if (fread(cmds, 1, record.cmd_bytes, fh) != record.cmd_bytes
+                || fread(relocs, sizeof(uint32_t), 2 * record.nrelocs, fh)
+                   != 2 * record.nrelocs) {
+            fprintf(stderr, "%s: truncated record, stopping\n",
+                    argv[optind]);
+            break;
+        }
+
+        t = record.tv_sec + record.tv_usec / 1000000.0;
+        if (!r->submissions)
+            r->first_time = t;
+        r->last_time = t;
+
+        r->submissions++;
+        r->cmd_bytes += record.cmd_bytes;
+        r->relocs += record.nrelocs;
+        for (bucket = 0; bucket < NUM_SIZE_BUCKETS - 1; bucket++) {
+            if (record.cmd_bytes < (1u << (bucket + 4)))
+                break;
+        }
+        r->sizes[bucket]++;
+
+        if (r->dump)
+            printf("Submission %lu at %u.%06u: %u bytes, %u relocations\n",
+                   r->submissions, record.tv_sec, record.tv_usec,
+                   record.cmd_bytes, record.nrelocs);
+
+        replay_record(r, cmds, record.cmd_bytes / 2,
+                      relocs + record.nrelocs, record.nrelocs);
+    }
+
+    fclose(fh);
+
+    if (r->dump)
+        printf("\n");
+    report(r, header.source);
+
+    free(cmds);
+    free(relocs);
+    free(r);
+
+    return 0;
+}